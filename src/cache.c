@@ -0,0 +1,607 @@
+/*-
+ * Copyright (c) 2011-2019 Ganael LAPLANCHE <ganael.laplanche@martymac.org>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHORS AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHORS OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include "types.h"
+#include "utils.h"
+#include "options.h"
+#include "cache.h"
+
+/* fprintf(3), fdopen(3), fwrite(3), rename(2) */
+#include <stdio.h>
+
+/* malloc(3), mkstemp(3) */
+#include <stdlib.h>
+
+/* strerror(3), strlen(3), memcpy(3) */
+#include <string.h>
+
+/* errno */
+#include <errno.h>
+
+/* assert(3) */
+#include <assert.h>
+
+#if defined(EMBED_FTS)
+
+/* uint32_t, uint64_t, int64_t */
+#include <stdint.h>
+
+/* open(2) */
+#include <fcntl.h>
+
+/* fstat(2), stat(2), fchmod(2) */
+#include <sys/types.h>
+#include <sys/stat.h>
+
+/* close(2), unlink(2) */
+#include <unistd.h>
+
+/* mmap(2) */
+#include <sys/mman.h>
+
+/* pthread_mutex_lock(3) */
+#include <pthread.h>
+
+/* Crawl cache file format (option -c), native byte order
+   - a header: magic string and flags
+   - then, for each directory listed, a directory record followed by its path
+     and, for each of its entries, an entry record followed by its name
+   A directory's listing is re-used if its device, inode, modification and
+   change times have not changed since it was recorded. */
+#define CACHE_MAGIC             "FPCACHE1"
+#define CACHE_MAGIC_LEN         8
+#define CACHE_FLAG_LOGICAL      0x01    /* symbolic links followed (-l) */
+
+/* Nanoseconds of modification and change times of struct stat st, when
+   available (st_mtim on POSIX.1-2008 systems, st_mtimespec on Darwin) */
+#if defined(HAVE_STRUCT_STAT_ST_MTIM)
+#define CACHE_MTIME_NSEC(st)    ((st)->st_mtim.tv_nsec)
+#define CACHE_CTIME_NSEC(st)    ((st)->st_ctim.tv_nsec)
+#elif defined(HAVE_STRUCT_STAT_ST_MTIMESPEC)
+#define CACHE_MTIME_NSEC(st)    ((st)->st_mtimespec.tv_nsec)
+#define CACHE_CTIME_NSEC(st)    ((st)->st_ctimespec.tv_nsec)
+#else
+#define CACHE_MTIME_NSEC(st)    0
+#define CACHE_CTIME_NSEC(st)    0
+#endif
+
+struct cache_header {
+    char magic[CACHE_MAGIC_LEN];
+    uint32_t flags;
+};
+
+struct cache_dir_record {
+    uint64_t dev;
+    uint64_t ino;
+    int64_t mtime_sec;
+    int64_t mtime_nsec;
+    int64_t ctime_sec;
+    int64_t ctime_nsec;
+    uint32_t path_len;
+    uint32_t num_entries;
+};
+
+struct cache_entry_record {
+    int64_t size;
+    uint32_t mode;
+    int32_t info;
+    uint32_t name_len;
+};
+
+/* A directory listing loaded from cache file */
+struct cache_dir {
+    const char *path;               /* path (not NUL-terminated) */
+    size_t path_len;                /* its length */
+    struct cache_dir_record record; /* directory's attributes */
+    FTSCACHEENT *entries;           /* its entries */
+};
+
+/*********************
+ Crawl cache's status
+ *********************/
+
+static struct {
+    char *filename;                 /* cache file */
+    char *tmp_filename;             /* new cache file, renamed when done */
+    FILE *tmp_fp;                   /* its stream */
+    int write_error;                /* error writing new cache file */
+    pthread_mutex_t write_mutex;    /* serializes writes (option -j) */
+    uint32_t flags;                 /* CACHE_FLAG_* */
+    void *data;                     /* cache file contents (mapped) */
+    size_t data_size;               /* size of mapping */
+    struct cache_dir *dirs;         /* directories loaded */
+    size_t num_dirs;                /* number of directories loaded */
+    FTSCACHEENT *entries;           /* entries of all directories */
+    size_t *buckets;                /* hash table (dir index + 1, 0 = free) */
+    size_t num_buckets;             /* size of hash table, power of 2 */
+    FTSCACHE fts_cache;             /* callbacks given to fts(3) */
+} cache_status = {
+    NULL,
+    NULL,
+    NULL,
+    0,
+    PTHREAD_MUTEX_INITIALIZER,
+    0,
+    NULL,
+    0,
+    NULL,
+    0,
+    NULL,
+    NULL,
+    0,
+    { NULL, NULL, NULL }
+};
+
+/*********************
+ Hash table functions
+ *********************/
+
+/* FNV-1a hash of path */
+static size_t
+cache_hash(const char *path, size_t len)
+{
+    uint64_t hash = 14695981039346656037ULL;
+    size_t i;
+    for(i = 0; i < len; i++) {
+        hash ^= (unsigned char)path[i];
+        hash *= 1099511628211ULL;
+    }
+    return ((size_t)hash);
+}
+
+/* Find directory path within loaded directories
+   - returns directory or NULL if not found */
+static const struct cache_dir *
+cache_find(const char *path, size_t len)
+{
+    if(cache_status.num_buckets == 0)
+        return (NULL);
+
+    size_t mask = cache_status.num_buckets - 1;
+    size_t i = cache_hash(path, len) & mask;
+    while(cache_status.buckets[i] != 0) {
+        const struct cache_dir *dir =
+            &cache_status.dirs[cache_status.buckets[i] - 1];
+        if((dir->path_len == len) && (memcmp(dir->path, path, len) == 0))
+            return (dir);
+        i = (i + 1) & mask;
+    }
+    return (NULL);
+}
+
+/**********************
+ Cache file functions
+ **********************/
+
+/* Parse mapped cache file, first to count (and check) directories and
+   entries, then (if dirs is not NULL) to fill dirs and entries
+   - returns 0 (success) or 1 (corrupted file) */
+static int
+cache_parse(size_t *num_dirs, size_t *num_entries, struct cache_dir *dirs,
+    FTSCACHEENT *entries)
+{
+    const char *data = cache_status.data;
+    size_t size = cache_status.data_size;
+    size_t offset = sizeof(struct cache_header);
+
+    *num_dirs = 0;
+    *num_entries = 0;
+    while(offset < size) {
+        struct cache_dir_record dir_record;
+        if((size - offset) < sizeof(dir_record))
+            return (1);
+        memcpy(&dir_record, data + offset, sizeof(dir_record));
+        offset += sizeof(dir_record);
+        if((size - offset) < dir_record.path_len)
+            return (1);
+        if(dirs != NULL) {
+            dirs[*num_dirs].path = data + offset;
+            dirs[*num_dirs].path_len = dir_record.path_len;
+            dirs[*num_dirs].record = dir_record;
+            dirs[*num_dirs].entries = &entries[*num_entries];
+        }
+        offset += dir_record.path_len;
+
+        uint32_t i;
+        for(i = 0; i < dir_record.num_entries; i++) {
+            struct cache_entry_record entry_record;
+            if((size - offset) < sizeof(entry_record))
+                return (1);
+            memcpy(&entry_record, data + offset, sizeof(entry_record));
+            offset += sizeof(entry_record);
+            if(((size - offset) < entry_record.name_len) ||
+                (entry_record.name_len == 0))
+                return (1);
+            if(entries != NULL) {
+                entries[*num_entries].fce_name = data + offset;
+                entries[*num_entries].fce_namelen = entry_record.name_len;
+                entries[*num_entries].fce_info = entry_record.info;
+                entries[*num_entries].fce_mode = entry_record.mode;
+                entries[*num_entries].fce_size = entry_record.size;
+            }
+            offset += entry_record.name_len;
+            (*num_entries)++;
+        }
+        (*num_dirs)++;
+    }
+    return (0);
+}
+
+/* Load cache file and index its directories
+   - a missing, foreign or corrupted cache file is ignored
+   - returns 0 (success) or 1 (failure) */
+static int
+cache_load(struct program_options *options)
+{
+    int fd = open(cache_status.filename, O_RDONLY);
+    if(fd < 0) {
+        if(errno == ENOENT)
+            return (0);
+        fprintf(stderr, "%s: %s\n", cache_status.filename, strerror(errno));
+        return (1);
+    }
+
+    struct stat st;
+    if(fstat(fd, &st) < 0) {
+        fprintf(stderr, "%s: %s\n", cache_status.filename, strerror(errno));
+        close(fd);
+        return (1);
+    }
+    if(st.st_size < (off_t)sizeof(struct cache_header)) {
+        close(fd);
+        goto ignore;
+    }
+
+    cache_status.data_size = (size_t)st.st_size;
+    cache_status.data = mmap(NULL, cache_status.data_size, PROT_READ,
+        MAP_PRIVATE, fd, 0);
+    close(fd);
+    if(cache_status.data == MAP_FAILED) {
+        fprintf(stderr, "%s: %s\n", cache_status.filename, strerror(errno));
+        cache_status.data = NULL;
+        cache_status.data_size = 0;
+        return (1);
+    }
+
+    /* check header */
+    struct cache_header header;
+    memcpy(&header, cache_status.data, sizeof(header));
+    if((memcmp(header.magic, CACHE_MAGIC, CACHE_MAGIC_LEN) != 0) ||
+        (header.flags != cache_status.flags))
+        goto ignore;
+
+    /* count, then load directories and entries */
+    size_t num_dirs = 0;
+    size_t num_entries = 0;
+    if(cache_parse(&num_dirs, &num_entries, NULL, NULL) != 0)
+        goto ignore;
+    if(num_dirs == 0)
+        goto ignore;
+
+    size_t num_buckets = 1;
+    while(num_buckets < (num_dirs * 2))
+        num_buckets <<= 1;
+
+    if_not_malloc(cache_status.dirs, num_dirs * sizeof(struct cache_dir),
+        return (1);
+    )
+    if(num_entries > 0) {
+        if_not_malloc(cache_status.entries,
+            num_entries * sizeof(FTSCACHEENT),
+            return (1);
+        )
+    }
+    if((cache_status.buckets = calloc(num_buckets, sizeof(size_t))) == NULL) {
+        fprintf(stderr, "%s(): cannot allocate memory\n", __func__);
+        return (1);
+    }
+    cache_status.num_buckets = num_buckets;
+    cache_parse(&num_dirs, &num_entries, cache_status.dirs,
+        cache_status.entries);
+    cache_status.num_dirs = num_dirs;
+
+    /* index directories (last listing recorded wins) */
+    size_t i;
+    for(i = 0; i < num_dirs; i++) {
+        size_t j = cache_hash(cache_status.dirs[i].path,
+            cache_status.dirs[i].path_len) & (num_buckets - 1);
+        while((cache_status.buckets[j] != 0) &&
+            ((cache_status.dirs[cache_status.buckets[j] - 1].path_len !=
+            cache_status.dirs[i].path_len) ||
+            (memcmp(cache_status.dirs[cache_status.buckets[j] - 1].path,
+            cache_status.dirs[i].path, cache_status.dirs[i].path_len) != 0)))
+            j = (j + 1) & (num_buckets - 1);
+        cache_status.buckets[j] = i + 1;
+    }
+
+    if(options->verbose >= OPT_VERBOSE)
+        fprintf(stderr, "Crawl cache: %lld directories, %lld entries "
+            "loaded.\n", (long long)num_dirs, (long long)num_entries);
+    return (0);
+
+ignore:
+    fprintf(stderr, "%s: invalid or incompatible crawl cache, ignoring it\n",
+        cache_status.filename);
+    if(cache_status.data != NULL)
+        munmap(cache_status.data, cache_status.data_size);
+    cache_status.data = NULL;
+    cache_status.data_size = 0;
+    return (0);
+}
+
+/* Create new cache file (next to the current one, with the same mode) and
+   write its header
+   - returns 0 (success) or 1 (failure) */
+static int
+cache_create(void)
+{
+    /* compute template "filename.XXXXXX\0" */
+    size_t malloc_size = strlen(cache_status.filename) +
+        strlen(".XXXXXX") + 1;
+    if_not_malloc(cache_status.tmp_filename, malloc_size,
+        return (1);
+    )
+    snprintf(cache_status.tmp_filename, malloc_size, "%s.XXXXXX",
+        cache_status.filename);
+
+    int fd = mkstemp(cache_status.tmp_filename);
+    if(fd < 0) {
+        fprintf(stderr, "%s: %s\n", cache_status.tmp_filename,
+            strerror(errno));
+        free(cache_status.tmp_filename);
+        cache_status.tmp_filename = NULL;
+        return (1);
+    }
+
+    /* mkstemp(3) creates a 0600 file : keep current cache file's mode */
+    struct stat st;
+    if(stat(cache_status.filename, &st) == 0) {
+        if(fchmod(fd, st.st_mode & 07777) != 0) {
+            fprintf(stderr, "%s: %s\n", cache_status.tmp_filename,
+                strerror(errno));
+            close(fd);
+            return (1);
+        }
+    }
+    else if(errno != ENOENT) {
+        fprintf(stderr, "%s: %s\n", cache_status.filename, strerror(errno));
+        close(fd);
+        return (1);
+    }
+
+    if((cache_status.tmp_fp = fdopen(fd, "w")) == NULL) {
+        fprintf(stderr, "%s(): %s\n", __func__, strerror(errno));
+        close(fd);
+        return (1);
+    }
+
+    struct cache_header header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, CACHE_MAGIC, CACHE_MAGIC_LEN);
+    header.flags = cache_status.flags;
+    if(fwrite(&header, sizeof(header), 1, cache_status.tmp_fp) != 1) {
+        fprintf(stderr, "%s: %s\n", cache_status.tmp_filename,
+            strerror(errno));
+        return (1);
+    }
+    return (0);
+}
+
+/****************
+ fts(3) callbacks
+ ****************/
+
+/* Return cached listing of directory ent, if it has not changed since it
+   has been recorded */
+static const FTSCACHEENT *
+cache_lookup(void *arg, const FTSENT *ent, size_t *num_entries)
+{
+    (void)arg;
+
+    const struct cache_dir *dir = cache_find(ent->fts_path, ent->fts_pathlen);
+    if(dir == NULL)
+        return (NULL);
+
+    const struct stat *st = ent->fts_statp;
+    if((dir->record.dev != (uint64_t)st->st_dev) ||
+        (dir->record.ino != (uint64_t)st->st_ino) ||
+        (dir->record.mtime_sec != (int64_t)st->st_mtime) ||
+        (dir->record.mtime_nsec != (int64_t)CACHE_MTIME_NSEC(st)) ||
+        (dir->record.ctime_sec != (int64_t)st->st_ctime) ||
+        (dir->record.ctime_nsec != (int64_t)CACHE_CTIME_NSEC(st)))
+        return (NULL);
+
+    /* empty directories are cheap to read again */
+    *num_entries = dir->record.num_entries;
+    return ((*num_entries > 0) ? dir->entries : NULL);
+}
+
+/* Record listing of directory ent to new cache file */
+static void
+cache_store(void *arg, const FTSENT *ent, const FTSENT *head)
+{
+    (void)arg;
+
+    const struct stat *st = ent->fts_statp;
+    const FTSENT *p;
+
+    struct cache_dir_record dir_record;
+    memset(&dir_record, 0, sizeof(dir_record));
+    dir_record.dev = (uint64_t)st->st_dev;
+    dir_record.ino = (uint64_t)st->st_ino;
+    dir_record.mtime_sec = (int64_t)st->st_mtime;
+    dir_record.mtime_nsec = (int64_t)CACHE_MTIME_NSEC(st);
+    dir_record.ctime_sec = (int64_t)st->st_ctime;
+    dir_record.ctime_nsec = (int64_t)CACHE_CTIME_NSEC(st);
+    dir_record.path_len = (uint32_t)ent->fts_pathlen;
+    for(p = head; p != NULL; p = p->fts_link)
+        dir_record.num_entries++;
+
+    pthread_mutex_lock(&cache_status.write_mutex);
+    if(cache_status.write_error)
+        goto unlock;
+    if((fwrite(&dir_record, sizeof(dir_record), 1,
+        cache_status.tmp_fp) != 1) ||
+        (fwrite(ent->fts_path, ent->fts_pathlen, 1,
+        cache_status.tmp_fp) != 1))
+        goto error;
+
+    for(p = head; p != NULL; p = p->fts_link) {
+        struct cache_entry_record entry_record;
+        memset(&entry_record, 0, sizeof(entry_record));
+        entry_record.size = (int64_t)p->fts_statp->st_size;
+        entry_record.mode = (uint32_t)p->fts_statp->st_mode;
+        entry_record.info = (int32_t)p->fts_info;
+        entry_record.name_len = (uint32_t)p->fts_namelen;
+        if((fwrite(&entry_record, sizeof(entry_record), 1,
+            cache_status.tmp_fp) != 1) ||
+            (fwrite(p->fts_name, p->fts_namelen, 1,
+            cache_status.tmp_fp) != 1))
+            goto error;
+    }
+    goto unlock;
+
+error:
+    fprintf(stderr, "%s: %s\n", cache_status.tmp_filename, strerror(errno));
+    cache_status.write_error = 1;
+unlock:
+    pthread_mutex_unlock(&cache_status.write_mutex);
+    return;
+}
+
+/************************
+ Crawl cache functions
+ ************************/
+
+/* Initialize crawl cache (option -c): load cache file and create the new one
+   - returns 0 (success) or 1 (failure) */
+int
+cache_init(struct program_options *options)
+{
+    assert(options != NULL);
+
+    if(options->cache_filename == NULL)
+        return (0);
+
+    cache_status.filename = options->cache_filename;
+    cache_status.flags =
+        (options->follow_symbolic_links == OPT_FOLLOWSYMLINKS) ?
+        CACHE_FLAG_LOGICAL : 0;
+
+    if((cache_load(options) != 0) || (cache_create() != 0)) {
+        cache_uninit(0);
+        return (1);
+    }
+
+    cache_status.fts_cache.fc_lookup = &cache_lookup;
+    cache_status.fts_cache.fc_store = &cache_store;
+    cache_status.fts_cache.fc_arg = NULL;
+    return (0);
+}
+
+/* Make fts(3) hierarchy ftsp use crawl cache, if initialized */
+void
+cache_fts(FTS *ftsp)
+{
+    assert(ftsp != NULL);
+
+    if(cache_status.tmp_fp != NULL)
+        fts_set_cache(ftsp, &cache_status.fts_cache);
+}
+
+/* Un-initialize crawl cache, replacing cache file with the new one if commit
+   is set (crawling succeeded)
+   - returns 0 (success) or 1 (new cache file could not be written) */
+int
+cache_uninit(int commit)
+{
+    int retval = 0;
+
+    if(cache_status.tmp_fp != NULL) {
+        if((fclose(cache_status.tmp_fp) != 0) && !cache_status.write_error) {
+            fprintf(stderr, "%s: %s\n", cache_status.tmp_filename,
+                strerror(errno));
+            cache_status.write_error = 1;
+        }
+        cache_status.tmp_fp = NULL;
+    }
+    if(cache_status.tmp_filename != NULL) {
+        if(commit && !cache_status.write_error) {
+            if(rename(cache_status.tmp_filename, cache_status.filename) != 0) {
+                fprintf(stderr, "%s: %s\n", cache_status.filename,
+                    strerror(errno));
+                retval = 1;
+            }
+        }
+        else if(commit)
+            retval = 1;
+        if(retval || !commit)
+            unlink(cache_status.tmp_filename);
+        free(cache_status.tmp_filename);
+        cache_status.tmp_filename = NULL;
+    }
+
+    if(cache_status.buckets != NULL)
+        free(cache_status.buckets);
+    if(cache_status.entries != NULL)
+        free(cache_status.entries);
+    if(cache_status.dirs != NULL)
+        free(cache_status.dirs);
+    if(cache_status.data != NULL)
+        munmap(cache_status.data, cache_status.data_size);
+
+    cache_status.filename = NULL;
+    cache_status.write_error = 0;
+    cache_status.flags = 0;
+    cache_status.data = NULL;
+    cache_status.data_size = 0;
+    cache_status.dirs = NULL;
+    cache_status.num_dirs = 0;
+    cache_status.entries = NULL;
+    cache_status.buckets = NULL;
+    cache_status.num_buckets = 0;
+    return (retval);
+}
+
+#else /* !EMBED_FTS */
+
+/* Crawl cache requires embedded fts(3), option -c is refused otherwise */
+int
+cache_init(struct program_options *options)
+{
+    assert(options != NULL);
+    assert(options->cache_filename == NULL);
+
+    return (0);
+}
+
+int
+cache_uninit(int commit)
+{
+    return (0);
+}
+
+#endif /* EMBED_FTS */
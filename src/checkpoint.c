@@ -0,0 +1,216 @@
+/*-
+ * Copyright (c) 2011-2019 Ganael LAPLANCHE <ganael.laplanche@martymac.org>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHORS AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHORS OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include "types.h"
+#include "options.h"
+#include "partition.h"
+#include "file_entry.h"
+#include "dispatch.h"
+#include "checkpoint.h"
+
+/* fprintf(3) */
+#include <stdio.h>
+
+/* free(3) */
+#include <stdlib.h>
+
+/* assert(3) */
+#include <assert.h>
+
+/********************
+ Checkpoint's status
+ ********************/
+
+/* Partitions still open in checkpoint mode (option -k)
+   - data partitions are dispatched with a first-fit algorithm (as with options
+     -f and -s) but, at each checkpoint, every data partition but the last one
+     is written and freed along with its file entries
+   - the default partition (option -s) is kept open until the end, its
+     file entries being appended to its file at each checkpoint */
+static struct {
+    struct partition *default_partition; /* partition 0 (option -s only) */
+    unsigned char default_written;  /* partition 0's file has been created */
+    struct partition *part_head;    /* first open data partition */
+    pnum_t first_index;             /* its index */
+    pnum_t num_parts;               /* number of partitions created */
+    fnum_t num_dispatched;          /* number of entries already dispatched */
+} checkpoint_status = {
+    NULL,
+    0,
+    NULL,
+    0,
+    0,
+    0
+};
+
+/**********************
+ Checkpoint functions
+ **********************/
+
+/* Dispatch new file entries from store, then write and remove
+   closed partitions
+   - every data partition but the last one is closed (all of them if final
+     is set)
+   - returns 0 (success) or 1 (failure) */
+static int
+flush_partitions(struct file_entry_store *store, int final,
+    struct program_options *options)
+{
+    assert(store != NULL);
+    assert(options != NULL);
+
+    /* create default and first data partitions on first pass */
+    if(checkpoint_status.part_head == NULL) {
+        if(options->max_size > 0) {
+            if(add_partitions(&checkpoint_status.default_partition, 1,
+                options) != 0) {
+                fprintf(stderr, "%s(): cannot init default partition\n",
+                    __func__);
+                return (1);
+            }
+            checkpoint_status.num_parts++;
+        }
+        if(add_partitions(&checkpoint_status.part_head, 1, options) != 0) {
+            fprintf(stderr, "%s(): cannot create partition\n", __func__);
+            return (1);
+        }
+        checkpoint_status.first_index = checkpoint_status.num_parts;
+        checkpoint_status.num_parts++;
+    }
+
+    /* dispatch file entries added since last checkpoint */
+    if(dispatch_file_entries_first_fit(store, checkpoint_status.num_dispatched,
+        checkpoint_status.default_partition, 0, checkpoint_status.part_head,
+        checkpoint_status.first_index, &checkpoint_status.num_parts,
+        options->max_entries, options->max_size, options) != 0)
+        return (1);
+
+    /* partitions to close: first_index to (last_index - 1) */
+    pnum_t last_index = final ? checkpoint_status.num_parts :
+        (checkpoint_status.num_parts - 1);
+
+    /* print closed partitions summary */
+    if(final && (checkpoint_status.default_partition != NULL))
+        fprintf(stderr, "Part #%d: size = %lld, %lld file(s)\n", 0,
+            checkpoint_status.default_partition->size,
+            checkpoint_status.default_partition->num_files);
+    struct partition *part = checkpoint_status.part_head;
+    pnum_t i;
+    for(i = checkpoint_status.first_index; i < last_index; i++) {
+        fprintf(stderr, "Part #%d: size = %lld, %lld file(s)\n", i,
+            part->size, part->num_files);
+        part = part->nextp;
+    }
+
+    /* write file entries, default partition's ones are appended (when no
+       checkpoint has been reached, write everything at once to keep the same
+       output as without option -k) */
+    pnum_t first_index = checkpoint_status.first_index;
+    if(checkpoint_status.default_partition != NULL) {
+        if(final && !checkpoint_status.default_written)
+            first_index = 0;
+        else {
+            if(print_file_entries(store, 0, 1,
+                checkpoint_status.default_written, options) != 0)
+                return (1);
+        }
+        checkpoint_status.default_written = 1;
+    }
+    if((last_index > first_index) &&
+        (print_file_entries(store, first_index, last_index - first_index, 0,
+        options) != 0))
+        return (1);
+
+    /* remove written file entries and closed partitions */
+    if(trim_file_entry_store(store, last_index) != 0)
+        return (1);
+    checkpoint_status.num_dispatched = store->num_entries;
+
+    while(checkpoint_status.first_index < last_index) {
+        part = checkpoint_status.part_head->nextp;
+        free(checkpoint_status.part_head);
+        checkpoint_status.part_head = part;
+        checkpoint_status.first_index++;
+    }
+    if(checkpoint_status.part_head != NULL)
+        checkpoint_status.part_head->prevp = NULL;
+
+    return (0);
+}
+
+/* Flush partitions if options->checkpoint file entries have been added
+   to store since last checkpoint
+   - store must be the main file entry store
+   - returns 0 (success) or 1 (failure) */
+int
+checkpoint_file_entries(struct file_entry_store *store,
+    struct program_options *options)
+{
+    assert(store != NULL);
+    assert(options != NULL);
+
+    if((options->checkpoint == DFLT_OPT_CHECKPOINT) ||
+        ((store->num_entries - checkpoint_status.num_dispatched) <
+        options->checkpoint))
+        return (0);
+
+    if(options->verbose >= OPT_VERBOSE)
+        fprintf(stderr, "Checkpoint reached, writing closed partitions...\n");
+
+    return (flush_partitions(store, 0, options));
+}
+
+/* Flush all remaining partitions and un-initialize checkpoint's status
+   - returns 0 (success) or 1 (failure) */
+int
+flush_checkpoint(struct file_entry_store *store,
+    struct program_options *options)
+{
+    assert(store != NULL);
+    assert(options != NULL);
+
+    int retval = flush_partitions(store, 1, options);
+    uninit_checkpoint();
+    return (retval);
+}
+
+/* Un-initialize checkpoint's status, discarding open partitions */
+void
+uninit_checkpoint(void)
+{
+    if(checkpoint_status.part_head != NULL)
+        uninit_partitions(checkpoint_status.part_head);
+    if(checkpoint_status.default_partition != NULL)
+        uninit_partitions(checkpoint_status.default_partition);
+
+    checkpoint_status.default_partition = NULL;
+    checkpoint_status.default_written = 0;
+    checkpoint_status.part_head = NULL;
+    checkpoint_status.first_index = 0;
+    checkpoint_status.num_parts = 0;
+    checkpoint_status.num_dispatched = 0;
+    return;
+}
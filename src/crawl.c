@@ -0,0 +1,804 @@
+/*-
+ * Copyright (c) 2011-2019 Ganael LAPLANCHE <ganael.laplanche@martymac.org>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHORS AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHORS OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include "types.h"
+#include "utils.h"
+#include "options.h"
+#include "file_entry.h"
+#include "crawl.h"
+#include "checkpoint.h"
+#include "extsort.h"
+#include "input.h"
+
+/* fprintf(3) */
+#include <stdio.h>
+
+/* malloc(3) */
+#include <stdlib.h>
+
+/* strerror(3), strlen(3) */
+#include <string.h>
+
+/* assert(3) */
+#include <assert.h>
+
+/* pthread(3) */
+#include <pthread.h>
+
+/*****************
+ Crawler's status
+ *****************/
+
+/* Maximum number of root tasks (input files and paths given on the command
+   line) pending collection, per crawler */
+#define CRAWL_ROOTS_PER_THREAD  4
+
+/* Number of buffered entries after which a task's part is completed (to be
+   collected while the task is still running) */
+#define CRAWL_PART_ENTRIES      4096
+
+/* Maximum number of buffered entries pending collection, per crawler, in
+   parts */
+#define CRAWL_PARTS_PER_THREAD  4
+
+/* Maximum memory used by buffered entries pending collection, as a share of
+   memory limit (option -M) */
+#define CRAWL_MEM_LIMIT_SHARE   4
+
+/* Pool of crawling threads */
+static struct {
+    pthread_t *threads;             /* worker threads */
+    unsigned int num_threads;       /* number of worker threads */
+    pthread_mutex_t lock;           /* protects the queue and flags below */
+    pthread_cond_t queue_cond;      /* a task has been queued (or exiting) */
+    pthread_cond_t done_cond;       /* a task has been crawled (or one of
+                                       its parts completed) */
+    pthread_cond_t space_cond;      /* entries have been collected (or
+                                       main thread waits for a task) */
+    struct crawl_task *queue_head;  /* first queued task */
+    struct crawl_task *queue_tail;  /* last queued task */
+    unsigned int num_queued;        /* number of queued tasks */
+    unsigned char exiting;          /* workers must exit */
+    unsigned char error;            /* a task failed, skip remaining ones */
+    fnum_t num_buffered;            /* number of entries within completed
+                                       parts, pending collection */
+    fnum_t max_buffered;            /* crawlers wait above that number */
+    size_t buffered_size;           /* memory used by those entries */
+    size_t max_buffered_size;       /* crawlers wait above that size (option
+                                       -M), 0 for no limit */
+    struct crawl_task *collecting;  /* task the main thread waits for */
+    pthread_mutex_t output_lock;    /* serializes live mode output */
+    struct crawl_task *roots_head;  /* first root task to collect (main
+                                       thread only) */
+    struct crawl_task *roots_tail;  /* last root task to collect */
+    unsigned int num_roots;         /* number of root tasks to collect */
+    struct program_options *options;
+} crawl_pool = {
+    NULL,
+    0,
+    PTHREAD_MUTEX_INITIALIZER,
+    PTHREAD_COND_INITIALIZER,
+    PTHREAD_COND_INITIALIZER,
+    PTHREAD_COND_INITIALIZER,
+    NULL,
+    NULL,
+    0,
+    0,
+    0,
+    0,
+    0,
+    0,
+    0,
+    NULL,
+    PTHREAD_MUTEX_INITIALIZER,
+    NULL,
+    NULL,
+    0,
+    NULL
+};
+
+/*********************************
+ Crawling tasks handling functions
+ *********************************/
+
+/* Create a new crawling task for path
+   - ancestors are copied from the parent task (if any) and completed with
+     directories found between parent task's root and path
+   - returns NULL if an error occurred */
+static struct crawl_task *
+new_task(const char *path, long base_level,
+    const struct crawl_task * const parent, const FTSENT * const p)
+{
+    assert(path != NULL);
+
+    struct crawl_task *task = NULL;
+    if_not_malloc(task, sizeof(struct crawl_task),
+        return (NULL);
+    )
+
+    size_t malloc_size = strlen(path) + 1;
+    if_not_malloc(task->path, malloc_size,
+        free(task);
+        return (NULL);
+    )
+    snprintf(task->path, malloc_size, "%s", path);
+
+    if_not_malloc(task->parts, sizeof(struct crawl_part),
+        free(task->path);
+        free(task);
+        return (NULL);
+    )
+    init_file_entry_store(&task->parts->entries);
+    task->parts->count = 0;
+    task->parts->child = NULL;
+    task->parts->nextp = NULL;
+
+    task->base_level = base_level;
+    task->input = 0;
+    task->packed = 0;
+    task->ancestors = NULL;
+    task->num_ancestors = 0;
+    task->cur_part = task->parts;
+    task->done = 0;
+    task->error = 0;
+    task->nextp = NULL;
+    task->next_root = NULL;
+
+    /* record ancestors, if requested */
+    if((parent != NULL) && (p != NULL)) {
+        fnum_t num_ancestors = parent->num_ancestors + p->fts_level;
+        if_not_malloc(task->ancestors,
+            sizeof(struct crawl_ancestor) * num_ancestors,
+            free(task->parts);
+            free(task->path);
+            free(task);
+            return (NULL);
+        )
+        fnum_t i;
+        for(i = 0; i < parent->num_ancestors; i++)
+            task->ancestors[i] = parent->ancestors[i];
+        const FTSENT *q = p->fts_parent;
+        while((q != NULL) && (q->fts_level >= FTS_ROOTLEVEL)) {
+            task->ancestors[i].dev = q->fts_statp->st_dev;
+            task->ancestors[i].ino = q->fts_statp->st_ino;
+            q = q->fts_parent;
+            i++;
+        }
+        task->num_ancestors = i;
+    }
+
+    return (task);
+}
+
+/* Free a crawling task
+   - task's parts must have been collected before */
+static void
+free_task(struct crawl_task *task)
+{
+    assert(task != NULL);
+    assert(task->parts == NULL);
+
+    if(task->ancestors != NULL)
+        free(task->ancestors);
+    free(task->path);
+    free(task);
+    return;
+}
+
+/* Allocate a new (empty) task part
+   - returns NULL if an error occurred */
+static struct crawl_part *
+new_part(void)
+{
+    struct crawl_part *part = NULL;
+    if_not_malloc(part, sizeof(struct crawl_part),
+        return (NULL);
+    )
+    init_file_entry_store(&part->entries);
+    part->count = 0;
+    part->child = NULL;
+    part->nextp = NULL;
+    return (part);
+}
+
+/* Account for a completed part's entries, pending collection
+   - crawl_pool.lock must be held */
+static void
+buffer_part(struct crawl_part *part)
+{
+    assert(part != NULL);
+
+    crawl_pool.num_buffered += part->entries.num_entries;
+    crawl_pool.buffered_size += get_file_entry_store_size(&part->entries);
+    return;
+}
+
+/* Complete task's current part, part becoming the current one */
+static void
+next_part(struct crawl_task *task, struct crawl_part *part)
+{
+    assert(task != NULL);
+    assert(task->cur_part != NULL);
+    assert(part != NULL);
+
+    pthread_mutex_lock(&crawl_pool.lock);
+    buffer_part(task->cur_part);
+    task->cur_part->nextp = part;
+    task->cur_part = part;
+    pthread_cond_broadcast(&crawl_pool.done_cond);
+    pthread_mutex_unlock(&crawl_pool.lock);
+    return;
+}
+
+/* Dequeue task if it is queued, or the first queued task if task is NULL
+   - crawl_pool.lock must be held
+   - returns the task dequeued, or NULL */
+static struct crawl_task *
+dequeue_task(struct crawl_task *task)
+{
+    struct crawl_task *prev = NULL;
+    struct crawl_task *next = crawl_pool.queue_head;
+    if(task != NULL) {
+        while((next != NULL) && (next != task)) {
+            prev = next;
+            next = next->nextp;
+        }
+    }
+    if(next == NULL)
+        return (NULL);
+
+    if(prev != NULL)
+        prev->nextp = next->nextp;
+    else
+        crawl_pool.queue_head = next->nextp;
+    if(crawl_pool.queue_tail == next)
+        crawl_pool.queue_tail = prev;
+    crawl_pool.num_queued--;
+    return (next);
+}
+
+/* Crawl a task (or read it, for an input file) and mark it as done */
+static void
+run_task(struct crawl_task *task, unsigned char skip)
+{
+    assert(task != NULL);
+
+    int error = 0;
+    if(!skip) {
+        if(task->input)
+            error = handle_input_file(task->path, task, NULL, NULL,
+                crawl_pool.options);
+        else
+            error = walk_file_entries(task->path, task, NULL, NULL,
+                crawl_pool.options);
+    }
+
+    pthread_mutex_lock(&crawl_pool.lock);
+    buffer_part(task->cur_part);
+    task->done = 1;
+    if(error != 0) {
+        task->error = 1;
+        crawl_pool.error = 1;
+    }
+    pthread_cond_broadcast(&crawl_pool.done_cond);
+    pthread_mutex_unlock(&crawl_pool.lock);
+    return;
+}
+
+/* Wait for buffered entries to be collected before going on with task (unless
+   the main thread waits for it), to bound memory usage
+   - meanwhile, run the task the main thread waits for if no thread picked it
+     up yet */
+static void
+crawl_wait_space(struct crawl_task *task)
+{
+    assert(task != NULL);
+
+    pthread_mutex_lock(&crawl_pool.lock);
+    while(((crawl_pool.num_buffered > crawl_pool.max_buffered) ||
+        ((crawl_pool.max_buffered_size > 0) &&
+        (crawl_pool.buffered_size > crawl_pool.max_buffered_size))) &&
+        (crawl_pool.collecting != task)) {
+        struct crawl_task *next = (crawl_pool.collecting != NULL) ?
+            dequeue_task(crawl_pool.collecting) : NULL;
+        if(next == NULL) {
+            pthread_cond_wait(&crawl_pool.space_cond, &crawl_pool.lock);
+            continue;
+        }
+        unsigned char skip = crawl_pool.error;
+        pthread_mutex_unlock(&crawl_pool.lock);
+
+        run_task(next, skip);
+
+        pthread_mutex_lock(&crawl_pool.lock);
+    }
+    pthread_mutex_unlock(&crawl_pool.lock);
+    return;
+}
+
+/* Worker thread main loop: pick up and crawl queued tasks (preferably the
+   one the main thread waits for) until crawl_uninit() is called */
+static void *
+crawl_worker(void *arg)
+{
+    (void)arg;
+
+    pthread_mutex_lock(&crawl_pool.lock);
+    while(1) {
+        while((crawl_pool.queue_head == NULL) && !crawl_pool.exiting)
+            pthread_cond_wait(&crawl_pool.queue_cond, &crawl_pool.lock);
+        if(crawl_pool.queue_head == NULL)
+            break;
+
+        /* dequeue task */
+        struct crawl_task *task = dequeue_task(crawl_pool.collecting);
+        if(task == NULL)
+            task = dequeue_task(NULL);
+        unsigned char skip = crawl_pool.error;
+        pthread_mutex_unlock(&crawl_pool.lock);
+
+        run_task(task, skip);
+
+        pthread_mutex_lock(&crawl_pool.lock);
+    }
+    pthread_mutex_unlock(&crawl_pool.lock);
+    return (NULL);
+}
+
+/* Collect a task's output in crawling order, as its parts (and sub-tasks)
+   are completed
+   - in non-live mode, append task's file entries to store (and flush it
+     as needed, see options -k and -M)
+   - in live mode, replay buffered entries (if any)
+   - updates count with the number of entries found
+   - returns != 0 if a critical error occurred */
+static int
+crawl_collect(struct crawl_task *task, struct file_entry_store *store,
+    fnum_t *count, struct program_options *options)
+{
+    assert(task != NULL);
+    assert(store != NULL);
+    assert(count != NULL);
+    assert(options != NULL);
+
+    int retval = 0;
+
+    struct crawl_part *part = task->parts;
+    while(part != NULL) {
+        /* wait for part to be completed, letting task's crawler go on even
+           if too many entries are pending collection */
+        pthread_mutex_lock(&crawl_pool.lock);
+        while((part == task->cur_part) && !task->done) {
+            if(crawl_pool.collecting != task) {
+                crawl_pool.collecting = task;
+                pthread_cond_broadcast(&crawl_pool.space_cond);
+            }
+            pthread_cond_wait(&crawl_pool.done_cond, &crawl_pool.lock);
+        }
+        crawl_pool.collecting = NULL;
+
+        /* part is no longer pending : let crawlers go on */
+        crawl_pool.num_buffered -= part->entries.num_entries;
+        crawl_pool.buffered_size -= get_file_entry_store_size(&part->entries);
+        pthread_cond_broadcast(&crawl_pool.space_cond);
+        pthread_mutex_unlock(&crawl_pool.lock);
+
+        if(options->live_mode == OPT_NOLIVEMODE) {
+            /* append part's entries */
+            if((retval == 0) &&
+                ((append_file_entry_store(store, &part->entries) != 0) ||
+                (checkpoint_file_entries(store, options) != 0) ||
+                (extsort_spill(store, options) != 0)))
+                retval = 1;
+        }
+        else {
+            /* replay buffered entries */
+            struct path_buffer buf;
+            const char *path;
+            fnum_t i;
+            init_path_buffer(&buf);
+            for(i = 0; (retval == 0) && (i < part->entries.num_entries); i++) {
+                if(((path = get_file_entry_path(&part->entries, i, &buf,
+                    NULL)) == NULL) ||
+                    (live_print_file_entry(path, part->entries.sizes[i],
+                    options) != 0))
+                    retval = 1;
+            }
+            uninit_path_buffer(&buf);
+        }
+        uninit_file_entry_store(&part->entries);
+        *count += part->count;
+
+        /* collect sub-task */
+        if(part->child != NULL) {
+            if(crawl_collect(part->child, store, count, options) != 0)
+                retval = 1;
+            free_task(part->child);
+        }
+
+        struct crawl_part *next = part->nextp;
+        free(part);
+        part = next;
+    }
+    task->parts = NULL;
+    task->cur_part = NULL;
+
+    pthread_mutex_lock(&crawl_pool.lock);
+    if(task->error)
+        retval = 1;
+    pthread_mutex_unlock(&crawl_pool.lock);
+
+    return (retval);
+}
+
+/* Collect the oldest root task, while it is being crawled
+   - returns != 0 if a critical error occurred */
+static int
+crawl_collect_root(struct file_entry_store *store, fnum_t *count,
+    struct program_options *options)
+{
+    assert(crawl_pool.roots_head != NULL);
+
+    struct crawl_task *task = crawl_pool.roots_head;
+    crawl_pool.roots_head = task->next_root;
+    if(crawl_pool.roots_head == NULL)
+        crawl_pool.roots_tail = NULL;
+    crawl_pool.num_roots--;
+
+    int retval = crawl_collect(task, store, count, options);
+    free_task(task);
+    return (retval);
+}
+
+/******************
+ Crawler functions
+ ******************/
+
+/* Start crawling threads
+   - the main thread collecting file entries, start num_jobs threads
+   - crawlers wait when too many file entries are pending collection (see
+     CRAWL_PARTS_PER_THREAD and option -k), or when they use too much memory
+     (see CRAWL_MEM_LIMIT_SHARE and option -M)
+   - nothing to crawl with option -I, nor with option -a unless several
+     input files are to be read (threads are then only used to sort)
+   - returns != 0 if a critical error occurred */
+int
+crawl_init(struct program_options *options)
+{
+    assert(options != NULL);
+    assert(crawl_pool.threads == NULL);
+
+    if((options->num_jobs <= 1) ||
+        ((options->arbitrary_values == OPT_ARBITRARYVALUES) &&
+        (options->nin_filenames <= 1)) ||
+        (options->snapshot_in != NULL))
+        return (0);
+
+    crawl_pool.options = options;
+    crawl_pool.exiting = 0;
+    crawl_pool.error = 0;
+    crawl_pool.roots_head = NULL;
+    crawl_pool.roots_tail = NULL;
+    crawl_pool.num_roots = 0;
+    crawl_pool.num_buffered = 0;
+    crawl_pool.max_buffered =
+        CRAWL_PART_ENTRIES * CRAWL_PARTS_PER_THREAD * options->num_jobs;
+    if((options->checkpoint != DFLT_OPT_CHECKPOINT) &&
+        (options->checkpoint < crawl_pool.max_buffered))
+        crawl_pool.max_buffered = options->checkpoint;
+    crawl_pool.buffered_size = 0;
+    crawl_pool.max_buffered_size = (size_t)options->mem_limit /
+        CRAWL_MEM_LIMIT_SHARE;
+    crawl_pool.collecting = NULL;
+
+    if_not_malloc(crawl_pool.threads,
+        sizeof(pthread_t) * options->num_jobs,
+        return (1);
+    )
+
+    while(crawl_pool.num_threads < options->num_jobs) {
+        int err = pthread_create(&crawl_pool.threads[crawl_pool.num_threads],
+            NULL, &crawl_worker, NULL);
+        if(err != 0) {
+            fprintf(stderr, "%s(): pthread_create(): %s\n", __func__,
+                strerror(err));
+            crawl_uninit();
+            return (1);
+        }
+        crawl_pool.num_threads++;
+    }
+    return (0);
+}
+
+/* Stop crawling threads */
+void
+crawl_uninit(void)
+{
+    if(crawl_pool.threads == NULL)
+        return;
+
+    pthread_mutex_lock(&crawl_pool.lock);
+    crawl_pool.exiting = 1;
+    pthread_cond_broadcast(&crawl_pool.queue_cond);
+    pthread_mutex_unlock(&crawl_pool.lock);
+
+    while(crawl_pool.num_threads > 0) {
+        pthread_join(crawl_pool.threads[crawl_pool.num_threads - 1], NULL);
+        crawl_pool.num_threads--;
+    }
+    free(crawl_pool.threads);
+    crawl_pool.threads = NULL;
+    crawl_pool.options = NULL;
+    return;
+}
+
+/* Return the memory used by file entries pending collection, in bytes */
+size_t
+crawl_buffered_size(void)
+{
+    pthread_mutex_lock(&crawl_pool.lock);
+    size_t size = crawl_pool.buffered_size;
+    pthread_mutex_unlock(&crawl_pool.lock);
+    return (size);
+}
+
+/* Return 1 if crawling threads have been started, else 0 */
+int
+crawl_active(void)
+{
+    return (crawl_pool.threads != NULL);
+}
+
+/* Queue path as a root task : an input file to read (option -i) if input is
+   set, else a path to crawl
+   - root tasks are run by any thread, their file entries are then collected
+     in queuing order (unless using live mode without option -J, where they
+     are output as soon as they are found)
+   - if too many root tasks are pending, collect the oldest one
+   - same semantics as init_file_entries() */
+int
+crawl_queue_root(char *path, unsigned char input,
+    struct file_entry_store *store, fnum_t *count,
+    struct program_options *options)
+{
+    assert(path != NULL);
+    assert(store != NULL);
+    assert(count != NULL);
+    assert(options != NULL);
+    assert(crawl_active());
+
+    struct crawl_task *task = new_task(path, 0, NULL, NULL);
+    if(task == NULL)
+        return (1);
+    task->input = input;
+
+    /* record task for collection */
+    if(crawl_pool.roots_tail != NULL)
+        crawl_pool.roots_tail->next_root = task;
+    else
+        crawl_pool.roots_head = task;
+    crawl_pool.roots_tail = task;
+    crawl_pool.num_roots++;
+
+    /* queue task */
+    pthread_mutex_lock(&crawl_pool.lock);
+    if(crawl_pool.queue_tail != NULL)
+        crawl_pool.queue_tail->nextp = task;
+    else
+        crawl_pool.queue_head = task;
+    crawl_pool.queue_tail = task;
+    crawl_pool.num_queued++;
+    pthread_cond_signal(&crawl_pool.queue_cond);
+    pthread_mutex_unlock(&crawl_pool.lock);
+
+#if defined(DEBUG)
+    fprintf(stderr, "%s(): queued %s%s\n", __func__, task->path,
+        input ? " (input file)" : "");
+#endif
+
+    if(crawl_pool.num_roots >
+        (crawl_pool.num_threads * CRAWL_ROOTS_PER_THREAD))
+        return (crawl_collect_root(store, count, options));
+
+    return (0);
+}
+
+/* Collect all pending root tasks
+   - returns != 0 if a critical error occurred */
+int
+crawl_flush_roots(struct file_entry_store *store, fnum_t *count,
+    struct program_options *options)
+{
+    assert(store != NULL);
+    assert(count != NULL);
+    assert(options != NULL);
+    assert(crawl_active());
+
+    int retval = 0;
+    while(crawl_pool.roots_head != NULL) {
+        if(crawl_collect_root(store, count, options) != 0)
+            retval = 1;
+    }
+
+    /* reset error flag for next paths */
+    pthread_mutex_lock(&crawl_pool.lock);
+    crawl_pool.error = 0;
+    pthread_mutex_unlock(&crawl_pool.lock);
+
+    return (retval);
+}
+
+/* Crawl file_path using crawling threads
+   - a thread crawls file_path, handing sub-trees over to idle threads
+   - file entries are collected in crawling order (unless using live
+     mode without option -J, where they are output as soon as they are found)
+   - same semantics as init_file_entries() */
+int
+crawl_file_entries(char *file_path, struct file_entry_store *store,
+    fnum_t *count, struct program_options *options)
+{
+    assert(file_path != NULL);
+    assert(store != NULL);
+    assert(count != NULL);
+    assert(options != NULL);
+    assert(crawl_active());
+
+    int retval = crawl_queue_root(file_path, 0, store, count, options);
+    if(crawl_flush_roots(store, count, options) != 0)
+        retval = 1;
+
+    return (retval);
+}
+
+/* Try to hand the sub-tree rooted at p over to another thread
+   - if packed is set, p is a directory packed because of option -d : the
+     other thread only computes its size and adds it
+   - returns 0 if the sub-tree has been queued (and must be skipped by the
+     caller), else 1 */
+int
+crawl_split(struct crawl_task *task, const FTSENT * const p,
+    unsigned char packed, struct program_options *options)
+{
+    assert(task != NULL);
+    assert(p != NULL);
+    assert(options != NULL);
+
+    /* never split a task's root */
+    if(p->fts_level <= FTS_ROOTLEVEL)
+        return (1);
+
+    /* do not hand mount points over when not crossing fs boundaries,
+       fts(3) will skip them */
+    if((options->cross_fs_boundaries == OPT_NOCROSSFSBOUNDARIES) &&
+        (p->fts_statp->st_dev != p->fts_parent->fts_statp->st_dev))
+        return (1);
+
+    /* do not queue more tasks than threads available */
+    pthread_mutex_lock(&crawl_pool.lock);
+    unsigned char busy = (crawl_pool.num_queued >= crawl_pool.num_threads);
+    pthread_mutex_unlock(&crawl_pool.lock);
+    if(busy)
+        return (1);
+
+    /* sub-task and next part of current task */
+    struct crawl_task *child = new_task(p->fts_path,
+        task->base_level + p->fts_level, task,
+        (options->follow_symbolic_links == OPT_FOLLOWSYMLINKS) ? p : NULL);
+    if(child == NULL)
+        return (1);
+    child->packed = packed;
+
+    struct crawl_part *part = new_part();
+    if(part == NULL) {
+        free(child->parts);
+        child->parts = NULL;
+        free_task(child);
+        return (1);
+    }
+
+    task->cur_part->child = child;
+    next_part(task, part);
+
+    /* queue sub-task */
+    pthread_mutex_lock(&crawl_pool.lock);
+    if(crawl_pool.queue_tail != NULL)
+        crawl_pool.queue_tail->nextp = child;
+    else
+        crawl_pool.queue_head = child;
+    crawl_pool.queue_tail = child;
+    crawl_pool.num_queued++;
+    pthread_cond_signal(&crawl_pool.queue_cond);
+    pthread_mutex_unlock(&crawl_pool.lock);
+
+#if defined(DEBUG)
+    fprintf(stderr, "%s(): queued %s (level %ld)\n", __func__,
+        child->path, child->base_level);
+#endif
+
+    return (0);
+}
+
+/* Check if directory p is one of task's ancestors
+   (i.e. if p causes a cycle that fts(3) cannot see from task's root)
+   - returns 1 if a loop has been detected, else 0 */
+int
+crawl_loop_detected(const struct crawl_task * const task,
+    const FTSENT * const p)
+{
+    assert(task != NULL);
+    assert(p != NULL);
+
+    fnum_t i;
+    for(i = 0; i < task->num_ancestors; i++) {
+        if((task->ancestors[i].dev == p->fts_statp->st_dev) &&
+            (task->ancestors[i].ino == p->fts_statp->st_ino))
+            return (1);
+    }
+    return (0);
+}
+
+/* Add or display a file entry found within a crawling task */
+int
+crawl_add_file_entry(struct crawl_task *task, char *path, fsize_t size,
+    struct program_options *options)
+{
+    assert(task != NULL);
+    assert(task->cur_part != NULL);
+    assert(path != NULL);
+    assert(options != NULL);
+
+    struct crawl_part *part = task->cur_part;
+
+    if(options->live_mode == OPT_NOLIVEMODE) {
+        if(add_file_entry(&part->entries, path, size, options) != 0)
+            return (1);
+    }
+    else if(options->keep_order == OPT_KEEPORDER) {
+        /* buffer raw entry, to be replayed by crawl_collect() */
+        if(push_file_entry(&part->entries, path, size) != 0)
+            return (1);
+    }
+    else {
+        pthread_mutex_lock(&crawl_pool.output_lock);
+        int retval = live_print_file_entry(path, size, options);
+        pthread_mutex_unlock(&crawl_pool.output_lock);
+        if(retval != 0)
+            return (1);
+    }
+
+    part->count++;
+
+    /* complete part once enough entries have been buffered, for it to be
+       collected while crawling goes on */
+    if(part->entries.num_entries >= CRAWL_PART_ENTRIES) {
+        if((part = new_part()) == NULL)
+            return (1);
+        next_part(task, part);
+        crawl_wait_space(task);
+    }
+
+    return (0);
+}
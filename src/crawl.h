@@ -0,0 +1,105 @@
+/*-
+ * Copyright (c) 2011-2019 Ganael LAPLANCHE <ganael.laplanche@martymac.org>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHORS AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHORS OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef _CRAWL_H
+#define _CRAWL_H
+
+#include "types.h"
+#include "options.h"
+#include "file_entry.h"
+
+#include <sys/types.h>
+
+/* fts(3) */
+#include <sys/stat.h>
+#if defined(EMBED_FTS)
+#include "fts.h"
+#else
+#include <fts.h>
+#endif
+
+/* A directory met on the way to a sub-tree, used to detect filesystem loops
+   when following symbolic links (option -l) */
+struct crawl_ancestor {
+    dev_t dev;                      /* device */
+    ino_t ino;                      /* inode */
+};
+
+/* A part of a crawling task's output
+   - file entries found by the task, followed by the output of a sub-task
+     (if any)
+   - a part is complete (and can be collected) once it is no longer its
+     task's current part, or once the task is done */
+struct crawl_task;
+struct crawl_part;
+struct crawl_part {
+    struct file_entry_store entries; /* file entries found */
+    fnum_t count;                   /* number of entries found */
+    struct crawl_task *child;       /* sub-task following entries */
+
+    struct crawl_part *nextp;       /* next part */
+};
+
+/* A crawling task (a sub-tree to be crawled by a single thread) */
+struct crawl_task {
+    char *path;                     /* sub-tree root */
+    long base_level;                /* level of path within original crawl */
+    unsigned char input;            /* path is an input file to read (option
+                                       -i) */
+    unsigned char packed;           /* path is a directory packed because of
+                                       option -d (and validated by parent
+                                       task) */
+    struct crawl_ancestor *ancestors; /* directories above path */
+    fnum_t num_ancestors;           /* number of ancestors */
+    struct crawl_part *parts;       /* ordered list of output parts */
+    struct crawl_part *cur_part;    /* part currently being filled
+                                       (changed with crawl_pool.lock held) */
+    unsigned char done;             /* task has been crawled */
+    unsigned char error;            /* a critical error occurred */
+
+    struct crawl_task *nextp;       /* next task in queue */
+    struct crawl_task *next_root;   /* next root task to collect */
+};
+
+int crawl_init(struct program_options *options);
+void crawl_uninit(void);
+int crawl_active(void);
+size_t crawl_buffered_size(void);
+int crawl_queue_root(char *path, unsigned char input,
+    struct file_entry_store *store, fnum_t *count,
+    struct program_options *options);
+int crawl_flush_roots(struct file_entry_store *store, fnum_t *count,
+    struct program_options *options);
+int crawl_file_entries(char *file_path, struct file_entry_store *store,
+    fnum_t *count, struct program_options *options);
+int crawl_split(struct crawl_task *task, const FTSENT * const p,
+    unsigned char packed, struct program_options *options);
+int crawl_loop_detected(const struct crawl_task * const task,
+    const FTSENT * const p);
+int crawl_add_file_entry(struct crawl_task *task, char *path, fsize_t size,
+    struct program_options *options);
+
+#endif /* _CRAWL_H */
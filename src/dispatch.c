@@ -28,242 +28,428 @@
 #include "utils.h"
 #include "dispatch.h"
 
-/* NULL */
+/* NULL, malloc(3), qsort(3) */
 #include <stdlib.h>
 
+/* memset(3), memcpy(3) */
+#include <string.h>
+
 /* fprintf(3) */
 #include <stdio.h>
 
 /* assert(3) */
 #include <assert.h>
 
+/* pthread(3) */
+#include <pthread.h>
+
 /*****************************
  File entry dispatch functions
  *****************************/
 
-/* Sort an array of file_entry pointers given file size, biggest to smallest
+/* Sort an array of file_entry keys given file size, biggest to smallest
+   (entries of the same size are kept in store order)
    This function is used by qsort(3) */
 int
-sort_file_entry_p(const void *a, const void *b)
+sort_file_entry_keys(const void *a, const void *b)
 {
-    assert((a != NULL) && (*(struct file_entry **)a != NULL));
-    assert((b != NULL) && (*(struct file_entry **)b != NULL));
+    assert(a != NULL);
+    assert(b != NULL);
+
+    const struct file_entry_key *key_a = (const struct file_entry_key *)a;
+    const struct file_entry_key *key_b = (const struct file_entry_key *)b;
 
-    if((*(struct file_entry **)a)->size < (*(struct file_entry **)b)->size)
+    if(key_a->size < key_b->size)
+        return (1);
+    else if(key_a->size > key_b->size)
+        return (-1);
+    else if(key_a->index > key_b->index)
         return (1);
-    else if((*(struct file_entry **)a)->size > (*(struct file_entry **)b)->size)
+    else if(key_a->index < key_b->index)
         return (-1);
     else
         return (0);
 }
 
+/* Get the radix sort digit of a file size for a given pass,
+   biggest sizes getting lowest digits (sizes are signed) */
+static inline unsigned int
+radix_digit(fsize_t size, unsigned int pass)
+{
+    unsigned long long key =
+        ~((unsigned long long)size ^ (1ULL << ((sizeof(fsize_t) * 8) - 1)));
+    return ((unsigned int)(key >> (pass * RADIX_SORT_BITS)) &
+        (RADIX_SORT_BUCKETS - 1));
+}
+
+/* Count digits of a slice of keys, for all passes */
+static void *
+radix_sort_count_all(void *arg)
+{
+    struct radix_sort_job *job = (struct radix_sort_job *)arg;
+    unsigned int pass;
+    fnum_t i;
+
+    memset(job->counts, 0, sizeof(job->counts));
+    for(i = job->first; i < job->last; i++)
+        for(pass = 0; pass < RADIX_SORT_PASSES; pass++)
+            job->counts[pass][radix_digit(job->src[i].size, pass)]++;
+    return (NULL);
+}
+
+/* Count digits of a slice of keys, for current pass */
+static void *
+radix_sort_count(void *arg)
+{
+    struct radix_sort_job *job = (struct radix_sort_job *)arg;
+    fnum_t i;
+
+    memset(job->counts[job->pass], 0, sizeof(job->counts[job->pass]));
+    for(i = job->first; i < job->last; i++)
+        job->counts[job->pass][radix_digit(job->src[i].size, job->pass)]++;
+    return (NULL);
+}
+
+/* Scatter a slice of keys to their buckets, for current pass
+   (counts must hold the slice's offsets within each bucket) */
+static void *
+radix_sort_scatter(void *arg)
+{
+    struct radix_sort_job *job = (struct radix_sort_job *)arg;
+    fnum_t *offsets = job->counts[job->pass];
+    fnum_t i;
+
+    for(i = job->first; i < job->last; i++)
+        job->dst[offsets[radix_digit(job->src[i].size, job->pass)]++] =
+            job->src[i];
+    return (NULL);
+}
+
+/* Run func on each job, using a thread per job (but the first one, which is
+   run by the calling thread)
+   - a job is run by the calling thread if its thread cannot be started */
+static void
+radix_sort_run(void *(*func)(void *), struct radix_sort_job *jobs,
+    unsigned int num_jobs)
+{
+    unsigned int j;
+
+    for(j = 1; j < num_jobs; j++)
+        jobs[j].started =
+            (pthread_create(&jobs[j].thread, NULL, func, &jobs[j]) == 0);
+    func(&jobs[0]);
+    for(j = 1; j < num_jobs; j++) {
+        if(jobs[j].started)
+            pthread_join(jobs[j].thread, NULL);
+        else
+            func(&jobs[j]);
+    }
+    return;
+}
+
+/* Sort an array of file_entry keys given file size, biggest to smallest,
+   using a LSD radix sort
+   - the sort is stable : keys initialized in store order (see
+     init_file_entry_keys()) end up sorted as with sort_file_entry_keys()
+   - passes where all keys share the same digit are skipped
+   - up to num_threads threads are used, each one counting and scattering
+     its own slice of keys (slices are placed in order within each bucket,
+     keeping the sort stable)
+   - falls back to qsort(3) if no temporary buffer can be allocated */
+void
+radix_sort_file_entry_keys(struct file_entry_key *keys, fnum_t num_entries,
+    unsigned int num_threads)
+{
+    assert(keys != NULL);
+    assert(num_threads > 0);
+
+    unsigned int pass;
+    unsigned int bucket;
+    unsigned int j;
+
+    if(num_entries < 2)
+        return;
+
+    /* temporary buffer and jobs (not using if_not_malloc() as we can fall
+       back to qsort(3) silently) */
+    unsigned int num_jobs = (unsigned int)min((fnum_t)num_threads,
+        max(num_entries / RADIX_SORT_MIN_JOB_ENTRIES, 1));
+    struct file_entry_key *tmp =
+        malloc(sizeof(struct file_entry_key) * num_entries);
+    struct radix_sort_job *jobs =
+        malloc(sizeof(struct radix_sort_job) * num_jobs);
+    if((tmp == NULL) || (jobs == NULL)) {
+        if(tmp != NULL)
+            free(tmp);
+        if(jobs != NULL)
+            free(jobs);
+        qsort(&keys[0], num_entries, sizeof(struct file_entry_key),
+            &sort_file_entry_keys);
+        return;
+    }
+
+    /* split keys into slices */
+    for(j = 0; j < num_jobs; j++) {
+        jobs[j].src = keys;
+        jobs[j].dst = tmp;
+        jobs[j].first = (num_entries / num_jobs) * j;
+        jobs[j].last = (j == (num_jobs - 1)) ? num_entries :
+            ((num_entries / num_jobs) * (j + 1));
+        jobs[j].pass = 0;
+    }
+
+    /* compute histograms of all passes at once */
+    radix_sort_run(&radix_sort_count_all, jobs, num_jobs);
+
+    int first_pass = 1;
+    for(pass = 0; pass < RADIX_SORT_PASSES; pass++) {
+        /* all keys share the same digit, nothing to do */
+        unsigned int digit = radix_digit(keys[0].size, pass);
+        fnum_t count = 0;
+        for(j = 0; j < num_jobs; j++)
+            count += jobs[j].counts[pass][digit];
+        if(count == num_entries)
+            continue;
+
+        /* keys have moved since histograms were computed, re-count
+           current pass for each slice */
+        for(j = 0; j < num_jobs; j++)
+            jobs[j].pass = pass;
+        if(!first_pass)
+            radix_sort_run(&radix_sort_count, jobs, num_jobs);
+        first_pass = 0;
+
+        /* compute slices' offsets within each bucket */
+        fnum_t offset = 0;
+        for(bucket = 0; bucket < RADIX_SORT_BUCKETS; bucket++) {
+            for(j = 0; j < num_jobs; j++) {
+                count = jobs[j].counts[pass][bucket];
+                jobs[j].counts[pass][bucket] = offset;
+                offset += count;
+            }
+        }
+
+        /* scatter keys */
+        radix_sort_run(&radix_sort_scatter, jobs, num_jobs);
+
+        for(j = 0; j < num_jobs; j++) {
+            struct file_entry_key *swap = jobs[j].src;
+            jobs[j].src = jobs[j].dst;
+            jobs[j].dst = swap;
+        }
+    }
+
+    if(jobs[0].src != keys)
+        memcpy(keys, jobs[0].src, sizeof(struct file_entry_key) * num_entries);
+
+    free(jobs);
+    free(tmp);
+    return;
+}
+
 /* Dispatch file_entries by assigning them a partition number
-   - a sorted array of file entry pointers must be provided as an argument
+   - a sorted array of file entry keys must be provided as an argument,
+     referring to entries within store
    - as well as a pointer to a double linked-list of partitions' head
-     that will contain the total amount of data of each assigned file */
+     that will contain the total amount of data of each assigned file
+   - the least-loaded partition is picked from a min-heap of partitions, the
+     lowest index winning on equal sizes */
 int
-dispatch_file_entry_p_by_size(struct file_entry **file_entry_p,
-    fnum_t num_entries, struct partition *head, pnum_t num_parts)
+dispatch_file_entry_keys_by_size(struct file_entry_key *keys,
+    fnum_t num_entries, struct file_entry_store *store,
+    struct partition *head, pnum_t num_parts)
 {
+    assert(keys != NULL);
+    assert(store != NULL);
     assert(head != NULL);
     assert(num_parts > 0);
 
-    fnum_t i = 0;
-    while((file_entry_p != NULL) && (file_entry_p[i] != NULL) &&
-        (i < num_entries)) {
+    /* array of partition pointers and heap of partition indexes */
+    struct partition **partition_p = NULL;
+    pnum_t *heap = NULL;
+    if_not_malloc(partition_p, sizeof(struct partition *) * num_parts,
+        return (1);
+    )
+    if_not_malloc(heap, sizeof(pnum_t) * num_parts,
+        free(partition_p);
+        return (1);
+    )
+    init_partition_p(partition_p, num_parts, head);
+    init_partition_heap(heap, num_parts, partition_p);
+
+    fnum_t i;
+    for(i = 0; i < num_entries; i++) {
         /* find most approriate partition */
-        pnum_t smallest_partition_index = find_smallest_partition_index(head);
+        pnum_t smallest_partition_index = heap[0];
         struct partition *smallest_partition =
-            get_partition_at(head, smallest_partition_index);
-        if(smallest_partition == NULL) {
-            fprintf(stderr, "%s(): get_partition_at() returned NULL\n",
-                __func__);
-            return (1);
-        }
+            partition_p[smallest_partition_index];
+
         /* assign it */
-        file_entry_p[i]->partition_index = smallest_partition_index;
+        store->partition_indexes[keys[i].index] = smallest_partition_index;
 #if defined(DEBUG)
         fprintf(stderr, "%s(): %s added to partition %d (%p)\n", __func__,
-            file_entry_p[i]->path, file_entry_p[i]->partition_index,
+            store->names[keys[i].index], smallest_partition_index,
             smallest_partition);
 #endif
         /* and load the partition with file size */
-        smallest_partition->size += file_entry_p[i]->size;
+        smallest_partition->size += keys[i].size;
         smallest_partition->num_files++;
-        i++;
+        update_partition_heap(heap, num_parts, partition_p);
     }
+
+    free(heap);
+    free(partition_p);
     return (0);
 }
 
-/* Dispatch empty file_entries (files with zero-byte size) from head by
+/* Dispatch empty file_entries (files with zero-byte size) from store by
    assigning them a more appropriate partition number.
    The idea is to get empty files spread accross partitions and not get them
    all in the last one.
    - a double-linked list of partitions is provided as an argument */
 int
-dispatch_empty_file_entries(struct file_entry *head, fnum_t num_entries,
-    struct partition *part_head, pnum_t num_parts)
+dispatch_empty_file_entries(struct file_entry_store *store,
+    fnum_t num_entries, struct partition *part_head, pnum_t num_parts)
 {
-    assert(head != NULL);
+    assert(store != NULL);
     assert(part_head != NULL);
     assert(num_parts > 0);
 
-    /* backup head */
-    struct file_entry *start = head;
-
-    /* first pass: count empty files */
-    fnum_t num_empty_entries = 0;
-    while(head != NULL) {
-        if(head->size == 0)
-            num_empty_entries++;
-        head = head->nextp;
-    }
-    /* go back to original head */
-    head = start;
-
     /* compute mean file entry number per partition */
     fnum_t mean_files = (num_entries / num_parts);
 
-    /* be sure to start at first partition as we are handling indexes here.
-       Starting at first file_entry is not necessary as we would not corrupt
-       any information, but just skip a few file entries */
-    rewind_list(part_head);
+    /* array of partition pointers, as we are handling indexes here */
+    struct partition **partition_p = NULL;
+    if_not_malloc(partition_p, sizeof(struct partition *) * num_parts,
+        return (1);
+    )
+    init_partition_p(partition_p, num_parts, part_head);
 
     /* for each empty file, associate it with the first partition
        having less files than mean_files */
-    while(head != NULL) {
-        if(head->size == 0) {
+    fnum_t i;
+    for(i = 0; i < store->num_entries; i++) {
+        if(store->sizes[i] == 0) {
             /* empty file found */
-            pnum_t j = 0;
-            /* backup partition head */
-            struct partition *part_start = part_head;
-
-            while(part_head != NULL) {
-                if((head->partition_index != j) &&
-                   (part_head->num_files < mean_files)) {
-                    struct partition *previous_partition =
-                        get_partition_at(part_start, head->partition_index);
-                    if(previous_partition == NULL) {
-                        fprintf(stderr, "%s(): "
-                            "get_partition_at() returned NULL\n", __func__);
-                        return (1);
-                    }
-                    /* unload the previous part (only affects the number
-                       of files, size does not change) */
-                    previous_partition->num_files--;
-                    /* load the new part */
-                    part_head->num_files++;
-                    /* assign new index to file entry */
-                    head->partition_index = j;
+            store->partition_indexes[i] = redispatch_empty_file_entry
+                (partition_p, num_parts, store->partition_indexes[i],
+                mean_files);
 #if defined(DEBUG)
-                    fprintf(stderr, "%s(): %s (empty) re-assigned to partition "
-                        "%d (%p)\n", __func__, head->path,
-                        head->partition_index, part_head);
+            fprintf(stderr, "%s(): %s (empty) assigned to partition %d\n",
+                __func__, store->names[i], store->partition_indexes[i]);
 #endif
-                    break;
-                }
-                part_head = part_head->nextp;
-                j++;
-            }
-            /* go back to original head */
-            part_head = part_start;
         }
-        head = head->nextp;
     }
+
+    free(partition_p);
     return (0);
 }
 
-/* Dispatch file_entries from head into partitions that will be created
-   on-the-fly, with respect to max_entries (maximum files per partitions)
-   and max_size (max partition size)
-   - must be called with *part_head == NULL (will create partitions)
-   - if max_size > 0, partition 0 will hold files that cannot be held by other
-     partitions
-   - returns the number of parts created with part_head set to the last
-     element */
+/* Re-dispatch an empty file entry currently assigned to partition
+   partition_index to the first other partition having less files than
+   mean_files (if any)
+   - partition_p is an array of num_parts partition pointers
+   - returns the new partition index of the entry */
 pnum_t
-dispatch_file_entries_by_limits(struct file_entry *head,
-    struct partition **part_head, fnum_t max_entries, fsize_t max_size,
-    struct program_options *options)
+redispatch_empty_file_entry(struct partition **partition_p, pnum_t num_parts,
+    pnum_t partition_index, fnum_t mean_files)
 {
-    assert(head != NULL);
-    assert((part_head != NULL) && (*part_head == NULL));
-    assert(max_size >= 0);
-    assert(options != NULL);
+    assert(partition_p != NULL);
+    assert(partition_index < num_parts);
 
-    /* number of partitions created, our return value */
-    pnum_t num_parts_created = 0;
-
-    /* when max_size is used, create a default partition (partition 0) 
-       that will hold files that does not match criteria */
-    if(max_size > 0) {
-        if(add_partitions(part_head, 1, options) != 0) {
-            fprintf(stderr, "%s(): cannot init default partition\n", __func__);
-            return (num_parts_created);
+    pnum_t j;
+    for(j = 0; j < num_parts; j++) {
+        if((partition_index != j) &&
+           (partition_p[j]->num_files < mean_files)) {
+            /* unload the previous part (only affects the number
+               of files, size does not change) */
+            partition_p[partition_index]->num_files--;
+            /* load the new part */
+            partition_p[j]->num_files++;
+            return (j);
         }
-        num_parts_created++;
     }
-    struct partition *default_partition = *part_head;
-    pnum_t default_partition_index = 0;
+    return (partition_index);
+}
 
-    /* create a first data partition and keep a pointer to it */
-    if(add_partitions(part_head, 1, options) != 0) {
-        fprintf(stderr, "%s(): cannot create partition\n", __func__);
-        return (num_parts_created);
-    }
-    num_parts_created++;
-    struct partition *start_partition = *part_head;
-    pnum_t start_partition_index = num_parts_created - 1;
+/* Dispatch file entries from store (starting at first_entry) into a list of
+   partitions, with respect to max_entries (maximum files per partitions) and
+   max_size (max partition size)
+   - each file goes to the first partition (from start_partition, whose index
+     is start_partition_index) able to hold it ; new partitions are chained to
+     the list when needed and *num_parts is incremented accordingly
+   - if max_size > 0, files that cannot be held by any partition go to
+     default_partition (whose index is default_partition_index)
+   - returns 0 (success) or 1 (failure) */
+int
+dispatch_file_entries_first_fit(struct file_entry_store *store,
+    fnum_t first_entry, struct partition *default_partition,
+    pnum_t default_partition_index, struct partition *start_partition,
+    pnum_t start_partition_index, pnum_t *num_parts, fnum_t max_entries,
+    fsize_t max_size, struct program_options *options)
+{
+    assert(store != NULL);
+    assert((max_size == 0) || (default_partition != NULL));
+    assert(start_partition != NULL);
+    assert(num_parts != NULL);
+    assert(max_size >= 0);
+    assert(options != NULL);
 
     /* for each file, associate it with current partition
        (or default_partition) */
-    pnum_t current_partition_index = start_partition_index;
-    while(head != NULL) {
+    fnum_t i;
+    for(i = first_entry; i < store->num_entries; i++) {
+        fsize_t size = store->sizes[i];
+
         /* max_size provided and file size > max_size,
            associate file to default partition */
-        if((max_size > 0) && (head->size > max_size)) {
-            head->partition_index = default_partition_index;
-            default_partition->size += head->size;
+        if((max_size > 0) && (size > max_size)) {
+            store->partition_indexes[i] = default_partition_index;
+            default_partition->size += size;
             default_partition->num_files++;
 #if defined(DEBUG)
             fprintf(stderr, "%s(): %s added to partition %d (%p)\n",
-                __func__, head->path, head->partition_index, default_partition);
+                __func__, store->names[i], store->partition_indexes[i],
+                default_partition);
 #endif
         }
         else {
+            struct partition *current_partition = start_partition;
+            pnum_t current_partition_index = start_partition_index;
+
             /* examine each partition */
-            while((*part_head) != NULL) {
+            while(current_partition != NULL) {
                 /* if file does not fit in partition */
-                if(((max_entries > 0) && (((*part_head)->num_files + 1) > max_entries)) ||
-                    ((max_size > 0) && (((*part_head)->size + head->size) > max_size))) {
+                if(((max_entries > 0) && ((current_partition->num_files + 1) > max_entries)) ||
+                    ((max_size > 0) && ((current_partition->size + size) > max_size))) {
                     /* and we reached last partition, chain a new one */
-                    if((*part_head)->nextp == NULL) {
-                        if(add_partitions(part_head, 1, options) != 0) {
+                    if(current_partition->nextp == NULL) {
+                        if(add_partitions(&current_partition, 1, options) != 0) {
                             fprintf(stderr, "%s(): cannot create partition\n",
                                 __func__);
-                            return (num_parts_created);
+                            return (1);
                         }
-                        num_parts_created++;
+                        (*num_parts)++;
 #if defined(DEBUG)
                         fprintf(stderr, "%s(): chained one partition (%p)\n",
-                            __func__, *part_head);
+                            __func__, current_partition);
 #endif
                     }
                     else {
                         /* examine next partition */
-                        *part_head = (*part_head)->nextp;
+                        current_partition = current_partition->nextp;
                     }
                     current_partition_index++;
                 }
                 else {
                     /* file fits in current partition, add it */
-                    head->partition_index = current_partition_index;
-                    (*part_head)->size += head->size;
-                    (*part_head)->num_files++;
+                    store->partition_indexes[i] = current_partition_index;
+                    current_partition->size += size;
+                    current_partition->num_files++;
 #if defined(DEBUG)
                     fprintf(stderr, "%s(): %s added to partition %d (%p)\n",
-                        __func__, head->path, head->partition_index,
-                        *part_head);
+                        __func__, store->names[i], store->partition_indexes[i],
+                        current_partition);
 #endif
 
                     /* examine next file */
@@ -271,15 +457,60 @@ dispatch_file_entries_by_limits(struct file_entry *head,
                 }
             }
 
-            assert(*part_head != NULL);
+            assert(current_partition != NULL);
         }
+    }
+    return (0);
+}
+
+/* Dispatch file_entries from store into partitions that will be created
+   on-the-fly, with respect to max_entries (maximum files per partitions)
+   and max_size (max partition size)
+   - must be called with *part_head == NULL (will create partitions)
+   - if max_size > 0, partition 0 will hold files that cannot be held by other
+     partitions
+   - returns the number of parts created with part_head set to the first data
+     partition */
+pnum_t
+dispatch_file_entries_by_limits(struct file_entry_store *store,
+    struct partition **part_head, fnum_t max_entries, fsize_t max_size,
+    struct program_options *options)
+{
+    assert(store != NULL);
+    assert((part_head != NULL) && (*part_head == NULL));
+    assert(max_size >= 0);
+    assert(options != NULL);
 
-        /* examine next file */
-        head = head->nextp;
+    /* number of partitions created, our return value */
+    pnum_t num_parts_created = 0;
 
-        /* come back to the first partition */
-        current_partition_index = start_partition_index;
-        *part_head = start_partition;
+    /* when max_size is used, create a default partition (partition 0) 
+       that will hold files that does not match criteria */
+    if(max_size > 0) {
+        if(add_partitions(part_head, 1, options) != 0) {
+            fprintf(stderr, "%s(): cannot init default partition\n", __func__);
+            return (num_parts_created);
+        }
+        num_parts_created++;
     }
+    struct partition *default_partition = *part_head;
+    pnum_t default_partition_index = 0;
+
+    /* create a first data partition and keep a pointer to it */
+    if(add_partitions(part_head, 1, options) != 0) {
+        fprintf(stderr, "%s(): cannot create partition\n", __func__);
+        return (num_parts_created);
+    }
+    num_parts_created++;
+    struct partition *start_partition = *part_head;
+    pnum_t start_partition_index = num_parts_created - 1;
+
+    /* dispatch files */
+    if(dispatch_file_entries_first_fit(store, 0, default_partition,
+        default_partition_index, start_partition, start_partition_index,
+        &num_parts_created, max_entries, max_size, options) != 0)
+        return (num_parts_created);
+
+    *part_head = start_partition;
     return (num_parts_created);
 }
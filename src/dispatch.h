@@ -32,12 +32,48 @@
 #include "file_entry.h"
 #include "options.h"
 
-int sort_file_entry_p(const void *a, const void *b);
-int dispatch_file_entry_p_by_size(struct file_entry **file_entry_p,
-    fnum_t num_entries, struct partition *head, pnum_t num_parts);
-int dispatch_empty_file_entries(struct file_entry *head, fnum_t num_entries,
-    struct partition *part_head, pnum_t num_parts);
-pnum_t dispatch_file_entries_by_limits(struct file_entry *head,
+/* pthread(3) */
+#include <pthread.h>
+
+#if !defined(RADIX_SORT_BITS)
+#define RADIX_SORT_BITS     8       /* radix sort digit size, in bits */
+#endif
+#define RADIX_SORT_BUCKETS  (1 << RADIX_SORT_BITS)
+#define RADIX_SORT_PASSES   ((sizeof(fsize_t) * 8) / RADIX_SORT_BITS)
+
+#if !defined(RADIX_SORT_MIN_JOB_ENTRIES)
+#define RADIX_SORT_MIN_JOB_ENTRIES 65536 /* minimum keys sorted per thread */
+#endif
+
+/* A radix sort job, working on a slice of keys */
+struct radix_sort_job {
+    struct file_entry_key *src;     /* keys to sort (current pass) */
+    struct file_entry_key *dst;     /* sorted keys (current pass) */
+    fnum_t first;                   /* first key of slice */
+    fnum_t last;                    /* last key of slice (excluded) */
+    unsigned int pass;              /* current pass */
+    fnum_t counts[RADIX_SORT_PASSES][RADIX_SORT_BUCKETS];
+                                    /* digit counts, then offsets */
+    pthread_t thread;               /* thread running the job */
+    int started;                    /* thread has been started */
+};
+
+int sort_file_entry_keys(const void *a, const void *b);
+void radix_sort_file_entry_keys(struct file_entry_key *keys,
+    fnum_t num_entries, unsigned int num_threads);
+int dispatch_file_entry_keys_by_size(struct file_entry_key *keys,
+    fnum_t num_entries, struct file_entry_store *store,
+    struct partition *head, pnum_t num_parts);
+int dispatch_empty_file_entries(struct file_entry_store *store,
+    fnum_t num_entries, struct partition *part_head, pnum_t num_parts);
+pnum_t redispatch_empty_file_entry(struct partition **partition_p,
+    pnum_t num_parts, pnum_t partition_index, fnum_t mean_files);
+int dispatch_file_entries_first_fit(struct file_entry_store *store,
+    fnum_t first_entry, struct partition *default_partition,
+    pnum_t default_partition_index, struct partition *start_partition,
+    pnum_t start_partition_index, pnum_t *num_parts, fnum_t max_entries,
+    fsize_t max_size, struct program_options *options);
+pnum_t dispatch_file_entries_by_limits(struct file_entry_store *store,
     struct partition **part_head, fnum_t max_entries, fsize_t max_size,
     struct program_options *options);
 
@@ -0,0 +1,606 @@
+/*-
+ * Copyright (c) 2011-2019 Ganael LAPLANCHE <ganael.laplanche@martymac.org>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHORS AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHORS OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include "types.h"
+#include "utils.h"
+#include "options.h"
+#include "partition.h"
+#include "file_entry.h"
+#include "dispatch.h"
+#include "extsort.h"
+#include "crawl.h"
+
+/* fprintf(3), fopen(3), fwrite(3), fread(3) */
+#include <stdio.h>
+
+/* malloc(3), getenv(3), mkstemp(3) */
+#include <stdlib.h>
+
+/* strerror(3), strlen(3) */
+#include <string.h>
+
+/* errno */
+#include <errno.h>
+
+/* assert(3) */
+#include <assert.h>
+
+/* pread(2), ftruncate(2), unlink(2), close(2) */
+#include <unistd.h>
+
+/* mmap(2) */
+#include <sys/mman.h>
+
+/**************************
+ External sort's status
+ **************************/
+
+/* Temporary files used when entries do not fit within memory limit
+   (option -M)
+   - entries file holds spilled file entries (size, path length, path), in
+     store order
+   - runs file holds sorted runs of keys, one per spill, back to back
+   - assignments is a file-backed array of partition indexes, indexed by
+     entry number */
+static struct {
+    FILE *entries_fp;               /* spilled file entries */
+    FILE *runs_fp;                  /* sorted runs of keys */
+    struct extsort_run *runs;       /* runs */
+    unsigned int num_runs;          /* number of runs */
+    unsigned int alloc_runs;        /* number of allocated runs */
+    fnum_t num_spilled;             /* number of entries spilled */
+    pnum_t *assignments;            /* partition indexes (mapped) */
+    size_t assignments_size;        /* size of mapping */
+} extsort_status = {
+    NULL,
+    NULL,
+    NULL,
+    0,
+    0,
+    0,
+    NULL,
+    0
+};
+
+/*************************
+ Temporary file functions
+ *************************/
+
+/* Create an anonymous temporary file within $TMPDIR (or /tmp)
+   - returns a file descriptor or -1 if an error occurred */
+static int
+extsort_tmpfile(void)
+{
+    const char *tmpdir = getenv("TMPDIR");
+    if((tmpdir == NULL) || (tmpdir[0] == '\0'))
+        tmpdir = "/tmp";
+
+    /* compute template "tmpdir/fpart.XXXXXX\0" */
+    char *template = NULL;
+    size_t malloc_size = strlen(tmpdir) + strlen("/fpart.XXXXXX") + 1;
+    if_not_malloc(template, malloc_size,
+        return (-1);
+    )
+    snprintf(template, malloc_size, "%s/fpart.XXXXXX", tmpdir);
+
+    int fd = mkstemp(template);
+    if(fd < 0)
+        fprintf(stderr, "%s: %s\n", template, strerror(errno));
+    else
+        /* file will be removed when closed */
+        unlink(template);
+
+    free(template);
+    return (fd);
+}
+
+/* Same as above, returning a stream */
+static FILE *
+extsort_tmpfp(void)
+{
+    int fd = extsort_tmpfile();
+    if(fd < 0)
+        return (NULL);
+
+    FILE *fp = fdopen(fd, "w+");
+    if(fp == NULL) {
+        fprintf(stderr, "%s(): %s\n", __func__, strerror(errno));
+        close(fd);
+    }
+    return (fp);
+}
+
+/*****************************
+ Spilling and merging functions
+ *****************************/
+
+/* Spill store's entries to temporary files
+   - entries are appended to entries file and their keys, sorted, are written
+     to runs file as a new run ; store is then emptied
+   - keys are sorted using num_threads threads
+   - returns 0 (success) or 1 (failure) */
+static int
+extsort_spill_store(struct file_entry_store *store, unsigned int num_threads)
+{
+    assert(store != NULL);
+
+    if(store->num_entries == 0)
+        return (0);
+
+    /* open temporary files on first spill */
+    if((extsort_status.entries_fp == NULL) &&
+        ((extsort_status.entries_fp = extsort_tmpfp()) == NULL))
+        return (1);
+    if((extsort_status.runs_fp == NULL) &&
+        ((extsort_status.runs_fp = extsort_tmpfp()) == NULL))
+        return (1);
+
+    /* make room for a new run */
+    if(extsort_status.num_runs >= extsort_status.alloc_runs) {
+        unsigned int alloc_runs = (extsort_status.alloc_runs > 0) ?
+            (extsort_status.alloc_runs * 2) : 16;
+        struct extsort_run *runs = extsort_status.runs;
+        if_not_realloc(runs, sizeof(struct extsort_run) * alloc_runs,
+            return (1);
+        )
+        extsort_status.runs = runs;
+        extsort_status.alloc_runs = alloc_runs;
+    }
+
+    /* sort keys and write them as a new run */
+    struct file_entry_key *keys = NULL;
+    if_not_malloc(keys, sizeof(struct file_entry_key) * store->num_entries,
+        return (1);
+    )
+    init_file_entry_keys(keys, store);
+    fnum_t i;
+    for(i = 0; i < store->num_entries; i++)
+        keys[i].index += extsort_status.num_spilled;
+    radix_sort_file_entry_keys(keys, store->num_entries, num_threads);
+
+    if(fwrite(keys, sizeof(struct file_entry_key), store->num_entries,
+        extsort_status.runs_fp) != store->num_entries) {
+        fprintf(stderr, "%s(): %s\n", __func__, strerror(errno));
+        free(keys);
+        return (1);
+    }
+
+    struct extsort_run *run = &extsort_status.runs[extsort_status.num_runs];
+    run->offset = extsort_status.num_spilled * sizeof(struct file_entry_key);
+    run->num_keys = store->num_entries;
+    run->first_empty = 0;
+    run->num_empty = 0;
+    for(i = 0; i < store->num_entries; i++) {
+        if(keys[i].size > 0)
+            run->first_empty = i + 1;
+        else if(keys[i].size == 0)
+            run->num_empty++;
+    }
+    extsort_status.num_runs++;
+    free(keys);
+
+    /* write entries */
+    struct path_buffer buf;
+    init_path_buffer(&buf);
+    for(i = 0; i < store->num_entries; i++) {
+        const char *path;
+        size_t path_len;
+        if(((path = get_file_entry_path(store, i, &buf, &path_len)) == NULL) ||
+            (fwrite(&store->sizes[i], sizeof(fsize_t), 1,
+            extsort_status.entries_fp) != 1) ||
+            (fwrite(&path_len, sizeof(size_t), 1,
+            extsort_status.entries_fp) != 1) ||
+            (fwrite(path, 1, path_len, extsort_status.entries_fp) !=
+            path_len)) {
+            fprintf(stderr, "%s(): %s\n", __func__, strerror(errno));
+            uninit_path_buffer(&buf);
+            return (1);
+        }
+    }
+    uninit_path_buffer(&buf);
+
+    extsort_status.num_spilled += store->num_entries;
+    uninit_file_entry_store(store);
+    return (0);
+}
+
+/* Fill a cursor with next keys from its run
+   - returns 0 (success) or 1 (failure) */
+static int
+extsort_fill_cursor(struct extsort_cursor *cursor)
+{
+    assert(cursor != NULL);
+    assert(cursor->remaining > 0);
+
+    size_t num_keys = min(cursor->remaining, EXTSORT_RUN_BUFFER_KEYS);
+    size_t to_read = sizeof(struct file_entry_key) * num_keys;
+    if(pread(fileno(extsort_status.runs_fp), cursor->keys, to_read,
+        cursor->offset) != (ssize_t)to_read) {
+        fprintf(stderr, "%s(): cannot read run\n", __func__);
+        return (1);
+    }
+    cursor->num_keys = num_keys;
+    cursor->pos = 0;
+    cursor->offset += to_read;
+    cursor->remaining -= num_keys;
+    return (0);
+}
+
+/* Compare current keys of two cursors */
+static int
+extsort_cursor_less(struct extsort_cursor *cursors, unsigned int a,
+    unsigned int b)
+{
+    return (sort_file_entry_keys(&cursors[a].keys[cursors[a].pos],
+        &cursors[b].keys[cursors[b].pos]) < 0);
+}
+
+/* Restore heap property of a heap of cursor indexes from node i */
+static void
+extsort_sift_down(unsigned int *heap, unsigned int heap_size,
+    struct extsort_cursor *cursors, unsigned int i)
+{
+    while(1) {
+        unsigned int smallest = i;
+        unsigned int left = (2 * i) + 1;
+        unsigned int right = left + 1;
+
+        if((left < heap_size) &&
+            extsort_cursor_less(cursors, heap[left], heap[smallest]))
+            smallest = left;
+        if((right < heap_size) &&
+            extsort_cursor_less(cursors, heap[right], heap[smallest]))
+            smallest = right;
+        if(smallest == i)
+            break;
+
+        unsigned int tmp = heap[i];
+        heap[i] = heap[smallest];
+        heap[smallest] = tmp;
+        i = smallest;
+    }
+    return;
+}
+
+/* Merge sorted runs and dispatch file entries by assigning them
+   a partition number, as dispatch_file_entry_keys_by_size() would do
+   - if empty_only is set, only merge empty files' keys and re-dispatch them,
+     as dispatch_empty_file_entries() would do
+   - returns 0 (success) or 1 (failure) */
+static int
+extsort_merge(int empty_only, struct partition **partition_p, pnum_t *heap,
+    pnum_t num_parts, fnum_t mean_files)
+{
+    assert(partition_p != NULL);
+    assert(heap != NULL);
+    assert(num_parts > 0);
+
+    int retval = 1;
+    struct extsort_cursor *cursors = NULL;
+    unsigned int *cursor_heap = NULL;
+    unsigned int heap_size = 0;
+    unsigned int i;
+
+    /* open a cursor on each run */
+    if_not_malloc(cursors,
+        sizeof(struct extsort_cursor) * extsort_status.num_runs,
+        return (1);
+    )
+    for(i = 0; i < extsort_status.num_runs; i++)
+        cursors[i].keys = NULL;
+    if_not_malloc(cursor_heap, sizeof(unsigned int) * extsort_status.num_runs,
+        goto cleanup;
+    )
+    for(i = 0; i < extsort_status.num_runs; i++) {
+        struct extsort_run *run = &extsort_status.runs[i];
+        cursors[i].offset = run->offset;
+        cursors[i].remaining = run->num_keys;
+        if(empty_only) {
+            cursors[i].offset +=
+                run->first_empty * sizeof(struct file_entry_key);
+            cursors[i].remaining = run->num_empty;
+        }
+        if(cursors[i].remaining == 0)
+            continue;
+
+        if_not_malloc(cursors[i].keys,
+            sizeof(struct file_entry_key) * EXTSORT_RUN_BUFFER_KEYS,
+            goto cleanup;
+        )
+        if(extsort_fill_cursor(&cursors[i]) != 0)
+            goto cleanup;
+        cursor_heap[heap_size] = i;
+        heap_size++;
+    }
+    for(i = heap_size / 2; i > 0; i--)
+        extsort_sift_down(cursor_heap, heap_size, cursors, i - 1);
+
+    /* merge runs */
+    int empty_found = 0;
+    pnum_t empty_partition_index = 0;
+    while(heap_size > 0) {
+        struct extsort_cursor *cursor = &cursors[cursor_heap[0]];
+        struct file_entry_key *key = &cursor->keys[cursor->pos];
+
+        if(empty_only) {
+            /* re-dispatch empty file */
+            extsort_status.assignments[key->index] =
+                redispatch_empty_file_entry(partition_p, num_parts,
+                extsort_status.assignments[key->index], mean_files);
+        }
+        else if(key->size == 0) {
+            /* empty files do not change partitions' sizes, so they all go
+               to the same partition */
+            if(!empty_found) {
+                empty_partition_index = heap[0];
+                empty_found = 1;
+            }
+            extsort_status.assignments[key->index] = empty_partition_index;
+            partition_p[empty_partition_index]->num_files++;
+        }
+        else {
+            /* find most approriate partition and assign it */
+            pnum_t smallest_partition_index = heap[0];
+            struct partition *smallest_partition =
+                partition_p[smallest_partition_index];
+            extsort_status.assignments[key->index] = smallest_partition_index;
+            smallest_partition->size += key->size;
+            smallest_partition->num_files++;
+            update_partition_heap(heap, num_parts, partition_p);
+        }
+
+        /* next key */
+        cursor->pos++;
+        if(cursor->pos >= cursor->num_keys) {
+            if(cursor->remaining > 0) {
+                if(extsort_fill_cursor(cursor) != 0)
+                    goto cleanup;
+            }
+            else {
+                /* run exhausted */
+                heap_size--;
+                cursor_heap[0] = cursor_heap[heap_size];
+            }
+        }
+        if(heap_size > 0)
+            extsort_sift_down(cursor_heap, heap_size, cursors, 0);
+    }
+    retval = 0;
+
+cleanup:
+    for(i = 0; i < extsort_status.num_runs; i++)
+        if(cursors[i].keys != NULL)
+            free(cursors[i].keys);
+    free(cursors);
+    if(cursor_heap != NULL)
+        free(cursor_heap);
+    return (retval);
+}
+
+/*******************
+ Exported functions
+ *******************/
+
+/* Return 1 if entries have been spilled to temporary files, else 0 */
+int
+extsort_active(void)
+{
+    return (extsort_status.num_runs > 0);
+}
+
+/* Spill store's entries to temporary files if store, the keys needed to
+   sort it (twice their size, see radix_sort_file_entry_keys()) and entries
+   pending collection (option -j) would exceed memory limit (option -M)
+   - store must be the main file entry store
+   - returns 0 (success) or 1 (failure) */
+int
+extsort_spill(struct file_entry_store *store, struct program_options *options)
+{
+    assert(store != NULL);
+    assert(options != NULL);
+
+    if((options->mem_limit == DFLT_OPT_MEM_LIMIT) ||
+        ((get_file_entry_store_size(store) +
+        (2 * sizeof(struct file_entry_key) * store->num_entries) +
+        crawl_buffered_size()) <
+        (size_t)options->mem_limit))
+        return (0);
+
+    if(options->verbose >= OPT_VERBOSE)
+        fprintf(stderr, "Memory limit reached, spilling %lld file(s)...\n",
+            store->num_entries);
+
+    return (extsort_spill_store(store, options->num_jobs));
+}
+
+/* Dispatch spilled file entries by assigning them a partition number
+   - remaining entries from store are spilled first
+   - sorted runs are merged and each entry is dispatched as
+     dispatch_file_entry_keys_by_size() and dispatch_empty_file_entries()
+     would do
+   - returns 0 (success) or 1 (failure) */
+int
+extsort_dispatch(struct file_entry_store *store, fnum_t num_entries,
+    struct partition *head, pnum_t num_parts,
+    struct program_options *options)
+{
+    assert(store != NULL);
+    assert(head != NULL);
+    assert(num_parts > 0);
+    assert(options != NULL);
+    assert(extsort_active());
+
+    if(extsort_spill_store(store, options->num_jobs) != 0)
+        return (1);
+    assert(extsort_status.num_spilled == num_entries);
+
+    if((fflush(extsort_status.entries_fp) != 0) ||
+        (fflush(extsort_status.runs_fp) != 0)) {
+        fprintf(stderr, "%s(): %s\n", __func__, strerror(errno));
+        return (1);
+    }
+
+    /* map assignments file */
+    int fd = extsort_tmpfile();
+    if(fd < 0)
+        return (1);
+    size_t assignments_size = sizeof(pnum_t) * num_entries;
+    if(ftruncate(fd, (off_t)assignments_size) != 0) {
+        fprintf(stderr, "%s(): %s\n", __func__, strerror(errno));
+        close(fd);
+        return (1);
+    }
+    void *assignments = mmap(NULL, assignments_size, PROT_READ | PROT_WRITE,
+        MAP_SHARED, fd, 0);
+    close(fd);
+    if(assignments == MAP_FAILED) {
+        fprintf(stderr, "%s(): %s\n", __func__, strerror(errno));
+        return (1);
+    }
+    extsort_status.assignments = (pnum_t *)assignments;
+    extsort_status.assignments_size = assignments_size;
+
+    /* array of partition pointers and heap of partition indexes */
+    struct partition **partition_p = NULL;
+    pnum_t *heap = NULL;
+    if_not_malloc(partition_p, sizeof(struct partition *) * num_parts,
+        return (1);
+    )
+    if_not_malloc(heap, sizeof(pnum_t) * num_parts,
+        free(partition_p);
+        return (1);
+    )
+    init_partition_p(partition_p, num_parts, head);
+    init_partition_heap(heap, num_parts, partition_p);
+
+    /* dispatch all files, then re-dispatch empty ones */
+    fnum_t mean_files = (num_entries / num_parts);
+    int retval = extsort_merge(0, partition_p, heap, num_parts, mean_files);
+    if(retval == 0)
+        retval = extsort_merge(1, partition_p, heap, num_parts, mean_files);
+
+    free(heap);
+    free(partition_p);
+    return (retval);
+}
+
+/* Print spilled file entries
+   - entries are read back to store by chunks fitting within memory limit,
+     then printed using print_file_entries()
+   - returns 0 (success) or 1 (failure) */
+int
+extsort_print_file_entries(struct file_entry_store *store, pnum_t num_parts,
+    struct program_options *options)
+{
+    assert(store != NULL);
+    assert(num_parts > 0);
+    assert(options != NULL);
+    assert(extsort_status.assignments != NULL);
+
+    int retval = 1;
+    int append = 0;
+    char *path = NULL;
+    size_t path_size = 0;
+
+    if(fseek(extsort_status.entries_fp, 0, SEEK_SET) != 0) {
+        fprintf(stderr, "%s(): %s\n", __func__, strerror(errno));
+        return (1);
+    }
+
+    fnum_t i;
+    for(i = 0; i < extsort_status.num_spilled; i++) {
+        fsize_t size;
+        size_t path_len;
+        if((fread(&size, sizeof(fsize_t), 1, extsort_status.entries_fp) != 1) ||
+            (fread(&path_len, sizeof(size_t), 1,
+            extsort_status.entries_fp) != 1)) {
+            fprintf(stderr, "%s(): cannot read file entry\n", __func__);
+            goto cleanup;
+        }
+        if(path_size < (path_len + 1)) {
+            char *new_path = path;
+            if_not_realloc(new_path, path_len + 1,
+                goto cleanup;
+            )
+            path = new_path;
+            path_size = path_len + 1;
+        }
+        if(fread(path, 1, path_len, extsort_status.entries_fp) != path_len) {
+            fprintf(stderr, "%s(): cannot read file entry\n", __func__);
+            goto cleanup;
+        }
+        path[path_len] = '\0';
+
+        if(push_file_entry(store, path, size) != 0)
+            goto cleanup;
+        store->partition_indexes[store->num_entries - 1] =
+            extsort_status.assignments[i];
+
+        /* print chunk */
+        if(get_file_entry_store_size(store) >= (size_t)options->mem_limit) {
+            if(print_file_entries(store, 0, num_parts, append, options) != 0)
+                goto cleanup;
+            append = 1;
+            uninit_file_entry_store(store);
+        }
+    }
+
+    /* print last chunk (creating files if needed) */
+    if(((store->num_entries > 0) || !append) &&
+        (print_file_entries(store, 0, num_parts, append, options) != 0))
+        goto cleanup;
+    retval = 0;
+
+cleanup:
+    uninit_file_entry_store(store);
+    if(path != NULL)
+        free(path);
+    return (retval);
+}
+
+/* Un-initialize external sort's status, closing temporary files */
+void
+extsort_uninit(void)
+{
+    if(extsort_status.entries_fp != NULL)
+        fclose(extsort_status.entries_fp);
+    if(extsort_status.runs_fp != NULL)
+        fclose(extsort_status.runs_fp);
+    if(extsort_status.runs != NULL)
+        free(extsort_status.runs);
+    if(extsort_status.assignments != NULL)
+        munmap(extsort_status.assignments, extsort_status.assignments_size);
+
+    extsort_status.entries_fp = NULL;
+    extsort_status.runs_fp = NULL;
+    extsort_status.runs = NULL;
+    extsort_status.num_runs = 0;
+    extsort_status.alloc_runs = 0;
+    extsort_status.num_spilled = 0;
+    extsort_status.assignments = NULL;
+    extsort_status.assignments_size = 0;
+    return;
+}
@@ -0,0 +1,66 @@
+/*-
+ * Copyright (c) 2011-2019 Ganael LAPLANCHE <ganael.laplanche@martymac.org>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHORS AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHORS OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef _EXTSORT_H
+#define _EXTSORT_H
+
+#include "types.h"
+#include "options.h"
+#include "partition.h"
+#include "file_entry.h"
+
+#if !defined(EXTSORT_RUN_BUFFER_KEYS)
+#define EXTSORT_RUN_BUFFER_KEYS 4096 /* keys read at once from each run */
+#endif
+
+/* A sorted run of file entry keys, within runs file */
+struct extsort_run {
+    off_t offset;                   /* offset of first key */
+    fnum_t num_keys;                /* number of keys */
+    fnum_t first_empty;             /* position of first empty file's key */
+    fnum_t num_empty;               /* number of empty files' keys */
+};
+
+/* A cursor used to read a run while merging */
+struct extsort_cursor {
+    struct file_entry_key *keys;    /* keys read */
+    size_t num_keys;                /* number of keys read */
+    size_t pos;                     /* current key */
+    off_t offset;                   /* offset of next keys to read */
+    fnum_t remaining;               /* number of keys not read yet */
+};
+
+int extsort_active(void);
+int extsort_spill(struct file_entry_store *store,
+    struct program_options *options);
+int extsort_dispatch(struct file_entry_store *store, fnum_t num_entries,
+    struct partition *head, pnum_t num_parts,
+    struct program_options *options);
+int extsort_print_file_entries(struct file_entry_store *store,
+    pnum_t num_parts, struct program_options *options);
+void extsort_uninit(void);
+
+#endif /* _EXTSORT_H */
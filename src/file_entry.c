@@ -28,6 +28,10 @@
 #include "utils.h"
 #include "options.h"
 #include "file_entry.h"
+#include "crawl.h"
+#include "checkpoint.h"
+#include "extsort.h"
+#include "cache.h"
 
 /* stat(2) */
 #include <sys/types.h>
@@ -60,6 +64,15 @@
 /* close(2) */
 #include <unistd.h>
 
+/* writev(2) */
+#include <sys/uio.h>
+
+/* PIPE_BUF */
+#include <limits.h>
+
+/* munmap(2) */
+#include <sys/mman.h>
+
 /* assert(3) */
 #include <assert.h>
 
@@ -73,13 +86,139 @@
 #include <paths.h>
 #endif
 
-/* signal(3) */
+/* signal(3), sigaction(2) */
 #include <signal.h>
 
+/* posix_spawn(3) */
+#if defined(HAVE_POSIX_SPAWN)
+#include <spawn.h>
+#endif
+
+/* walk_file_entries() directory marks (stored in fts_number) */
+#define WALK_NONE   0               /* regular directory */
+#define WALK_SPLIT  1               /* sub-tree handed over to a thread */
+#define WALK_LOOP   2               /* loop not seen by fts(3) */
+
 #if defined(__GNUC__)
 static void kill_child(int)  __attribute__((__noreturn__));
 #endif
 
+/************************
+ Output buffer functions
+ ************************/
+
+/* Initialize an output buffer of size bytes
+   - if it cannot be allocated, writes will not be buffered */
+static void
+init_output_buffer(struct output_buffer *out, size_t size)
+{
+    assert(out != NULL);
+
+    out->len = 0;
+    if((out->data = malloc(size)) != NULL)
+        out->size = size;
+    else
+        out->size = 0;
+    return;
+}
+
+/* Un-initialize an output buffer
+   - pending data is lost, see flush_output_buffer() */
+static void
+uninit_output_buffer(struct output_buffer *out)
+{
+    assert(out != NULL);
+
+    if(out->data != NULL) {
+        free(out->data);
+        out->data = NULL;
+    }
+    out->len = 0;
+    out->size = 0;
+    return;
+}
+
+/* Write iovcnt buffers to fd, handling short writes
+   - iov is modified
+   - returns 0 (success) or 1 (failure, errno is set) */
+static int
+writev_all(int fd, struct iovec *iov, int iovcnt)
+{
+    assert(iov != NULL);
+
+    while(iovcnt > 0) {
+        /* skip buffers already written */
+        if(iov->iov_len == 0) {
+            iov++;
+            iovcnt--;
+            continue;
+        }
+
+        ssize_t written = writev(fd, iov, iovcnt);
+        if(written < 0) {
+            if(errno == EINTR)
+                continue;
+            return (1);
+        }
+
+        while((iovcnt > 0) && ((size_t)written >= iov->iov_len)) {
+            written -= iov->iov_len;
+            iov++;
+            iovcnt--;
+        }
+        if(iovcnt > 0) {
+            iov->iov_base = (char *)iov->iov_base + written;
+            iov->iov_len -= written;
+        }
+    }
+    return (0);
+}
+
+/* Write pending data of an output buffer to fd
+   - returns 0 (success) or 1 (failure, errno is set) */
+static int
+flush_output_buffer(struct output_buffer *out, int fd)
+{
+    assert(out != NULL);
+
+    struct iovec iov[1];
+    iov[0].iov_base = out->data;
+    iov[0].iov_len = out->len;
+
+    out->len = 0;
+    return (writev_all(fd, iov, 1));
+}
+
+/* Write a path and its terminator to fd through an output buffer
+   - when the buffer is full, pending data, path and terminator are written
+     using a single writev(2) call
+   - returns 0 (success) or 1 (failure, errno is set) */
+static int
+output_buffer_write(struct output_buffer *out, int fd, const char *path,
+    size_t path_len, char ln_term)
+{
+    assert(out != NULL);
+    assert(path != NULL);
+
+    if((out->len + path_len + 1) <= out->size) {
+        memcpy(&out->data[out->len], path, path_len);
+        out->len += path_len;
+        out->data[out->len++] = ln_term;
+        return (0);
+    }
+
+    struct iovec iov[3];
+    iov[0].iov_base = out->data;
+    iov[0].iov_len = out->len;
+    iov[1].iov_base = (char *)path;
+    iov[1].iov_len = path_len;
+    iov[2].iov_base = &ln_term;
+    iov[2].iov_len = 1;
+
+    out->len = 0;
+    return (writev_all(fd, iov, 3));
+}
+
 /****************************
  Live-mode related functions 
  ****************************/
@@ -95,6 +234,12 @@ static struct {
     int exit_summary;            /* 0 if every single hook exit()ed with 0,
                                     else 1 */
     pid_t child_pid;
+    struct output_buffer out;    /* current file's output buffer */
+    struct live_hook *hooks;     /* running asynchronous hooks (option -H),
+                                    in start order */
+    unsigned int num_hooks;      /* number of running asynchronous hooks */
+    pid_t coproc_pid;            /* hook co-process (option -P) */
+    int coproc_fd;               /* pipe to hook co-process */
 } live_status = {
     STDOUT_FILENO,
     NULL,
@@ -102,10 +247,18 @@ static struct {
     0,
     0,
     0,
+    -1,
+    { NULL, 0, 0 },
+    NULL,
+    0,
+    -1,
     -1
 };
 
-/* Signal handler, kills child and exit() */
+/* set by SIGCHLD handler, asynchronous hooks have to be reaped */
+static volatile sig_atomic_t live_hooks_exited = 0;
+
+/* Signal handler, kills children and exit() */
 static void
 kill_child(int sig)
 {
@@ -117,49 +270,135 @@ kill_child(int sig)
         killpg(live_status.child_pid, sig ? sig : SIGTERM);
         waitpid(live_status.child_pid, NULL, 0);
     }
+
+    /* hook co-process (option -P) */
+    if(live_status.coproc_pid > 1) {
+        killpg(live_status.coproc_pid, sig ? sig : SIGTERM);
+        waitpid(live_status.coproc_pid, NULL, 0);
+    }
+
+    /* asynchronous hooks and jobs (option -H) */
+    unsigned int i;
+    for(i = 0; i < live_status.num_hooks; i++) {
+        if(live_status.hooks[i].pid > 1) {
+            killpg(live_status.hooks[i].pid, sig ? sig : SIGTERM);
+            waitpid(live_status.hooks[i].pid, NULL, 0);
+        }
+    }
     exit(EXIT_FAILURE);
 }
 
-/* Executes 'cmd' and waits for it to terminate
-   - returns 0 if cmd has been executed and its return code was 0,
-     else returns 1 */
-int
-fpart_hook(const char *cmd, const struct program_options *options,
-    const char *live_filename, const pnum_t *live_partition_index,
-    const fsize_t *live_partition_size, const fnum_t *live_num_files)
+/* SIGCHLD handler, records that asynchronous hooks have to be reaped */
+static void
+hook_exited(int sig)
 {
-    assert(cmd != NULL);
-    assert(options != NULL);
+    (void)sig;
 
-    int retval = 0;
+    live_hooks_exited = 1;
+    return;
+}
+
+/* Hooks' environment : a copy of environ(7), built once, followed by
+   FPART_* variables (filled in for each hook) */
+#define HOOK_ENV_NUM_VARS       6
+#define HOOK_ENV_VAR_SIZE       64  /* FPART_* variables but file name */
+static struct {
+    char **envp;                    /* environment passed to hooks */
+    unsigned int base;              /* index of first FPART_* variable */
+    char *partfilename;             /* FPART_PARTFILENAME */
+    size_t partfilename_size;       /* allocated size */
+    char partnumber[HOOK_ENV_VAR_SIZE]; /* FPART_PARTNUMBER */
+    char partsize[HOOK_ENV_VAR_SIZE]; /* FPART_PARTSIZE */
+    char partnumfiles[HOOK_ENV_VAR_SIZE]; /* FPART_PARTNUMFILES */
+    char pid[HOOK_ENV_VAR_SIZE];    /* FPART_PID */
+} hook_env = {
+    NULL,
+    0,
+    NULL,
+    0,
+    "",
+    "",
+    "",
+    ""
+};
+
+/* Build hooks' environment template, once
+   - XXX As setenv(3)/unsetenv(3) are not available on all platforms, and
+     there does not seem to be a standard way of unsetting variables through
+     putenv(3), clone current environment (to avoid working on environ(7))
+     and leave room for fpart variables. This is a convenient way of starting
+     from a clean environment and add only needed FPART_* variables for each
+     hook (putenv(3) would leave variables from a hook to another, even if
+     next hooks do not need them)
+   - returns 0 (success) or 1 (failure) */
+static int
+init_hook_env(void)
+{
+    if(hook_env.envp != NULL)
+        return (0);
 
-    /* env variables' names */
-    char *env_fpart_hooktype_name = "FPART_HOOKTYPE";
-    char *env_fpart_partfilename_name = "FPART_PARTFILENAME";
-    char *env_fpart_partnumber_name = "FPART_PARTNUMBER";
-    char *env_fpart_partsize_name = "FPART_PARTSIZE";
-    char *env_fpart_partnumfiles_name = "FPART_PARTNUMFILES";
-    char *env_fpart_pid_name = "FPART_PID";
-
-    /* env variables' values */
-    char *env_fpart_hooktype_string = NULL;
-    char *env_fpart_partfilename_string = NULL;
-    char *env_fpart_partnumber_string = NULL;
-    char *env_fpart_partsize_string = NULL;
-    char *env_fpart_partnumfiles_string = NULL;
-    char *env_fpart_pid_string = NULL;
-
-    /* XXX As setenv(3)/unsetenv(3) are not available on all platforms, and there does not
-    seem to be a standard way of unsetting variables through putenv(3), clone current
-    environment (to avoid working on environ(7)) and add fpart variables. This is a convenient
-    way of starting from a clean environment and add only needed FPART_* variables for each hook
-    (putenv(3) would leave variables from a hook to another, even if next hooks do not need
-    them) */
     char **envp = clone_env();
     if(envp == NULL)
         return (1);
 
-    size_t malloc_size = 1; /* empty string */
+    unsigned int env_size = 0;
+    while(envp[env_size] != NULL)
+        env_size++;
+
+    /* room for FPART_* variables and ending NULL */
+    char **new_envp = realloc(envp,
+        sizeof(char *) * (env_size + HOOK_ENV_NUM_VARS + 1));
+    if(new_envp == NULL) {
+        fprintf(stderr, "%s(): cannot allocate memory\n", __func__);
+        free(envp);
+        return (1);
+    }
+    hook_env.envp = new_envp;
+    hook_env.base = env_size;
+
+    /* FPART_PID never changes */
+    snprintf(hook_env.pid, sizeof(hook_env.pid), "FPART_PID=%d",
+        (int)getpid());
+    return (0);
+}
+
+/* Free hooks' environment template */
+static void
+uninit_hook_env(void)
+{
+    if(hook_env.envp != NULL) {
+        free(hook_env.envp);
+        hook_env.envp = NULL;
+    }
+    if(hook_env.partfilename != NULL) {
+        free(hook_env.partfilename);
+        hook_env.partfilename = NULL;
+    }
+    hook_env.partfilename_size = 0;
+    return;
+}
+
+/* Starts 'cmd' within its own process group (see fpart_hook())
+   - if in_fd is not -1, cmd's input is read from that descriptor
+   - if log_filename is not NULL, cmd's output is redirected to that file
+   - cmd is started using posix_spawn(3) (when available), so that starting
+     it does not depend on fpart's memory footprint
+   - sets pid to the hook's process ID
+   - returns 0 if cmd has been started, else returns 1 */
+static int
+start_hook(const char *cmd, const struct program_options *options,
+    const char *live_filename, const pnum_t *live_partition_index,
+    const fsize_t *live_partition_size, const fnum_t *live_num_files,
+    int in_fd, const char *log_filename, pid_t *pid)
+{
+    assert(cmd != NULL);
+    assert(options != NULL);
+    assert(pid != NULL);
+
+    if(init_hook_env() != 0)
+        return (1);
+
+    unsigned int env_index = hook_env.base;
 
     /* determine the kind of hook we are in */
     if(cmd == options->pre_part_hook) {
@@ -172,18 +411,7 @@ fpart_hook(const char *cmd, const struct program_options *options,
                 *live_partition_index, cmd);
 
         /* FPART_HOOKTYPE (pre-part) */
-        malloc_size = strlen(env_fpart_hooktype_name) + 1 +
-            strlen("pre-part") + 1;
-        if_not_malloc(env_fpart_hooktype_string, malloc_size,
-            retval = 1;
-            goto cleanup;
-        )
-        snprintf(env_fpart_hooktype_string, malloc_size, "%s=%s",
-            env_fpart_hooktype_name, "pre-part");
-        if(push_env(env_fpart_hooktype_string, &envp) != 0) {
-            retval = 1;
-            goto cleanup;
-        }
+        hook_env.envp[env_index++] = "FPART_HOOKTYPE=pre-part";
     }
     else if(cmd == options->post_part_hook) {
         assert(live_partition_index != NULL);
@@ -195,365 +423,1468 @@ fpart_hook(const char *cmd, const struct program_options *options,
                 *live_partition_index, cmd);
 
         /* FPART_HOOKTYPE (post-part) */
-        malloc_size = strlen(env_fpart_hooktype_name) + 1 +
-            strlen("post-part") + 1;
-        if_not_malloc(env_fpart_hooktype_string, malloc_size,
-            retval = 1;
-            goto cleanup;
-        )
-        snprintf(env_fpart_hooktype_string, malloc_size, "%s=%s",
-            env_fpart_hooktype_name, "post-part");
-        if(push_env(env_fpart_hooktype_string, &envp) != 0) {
-            retval = 1;
-            goto cleanup;
-        }
+        hook_env.envp[env_index++] = "FPART_HOOKTYPE=post-part";
     }
 
     /* FPART_PARTFILENAME */
     if(live_filename != NULL) {
-        malloc_size = strlen(env_fpart_partfilename_name) + 1 +
+        size_t malloc_size = strlen("FPART_PARTFILENAME=") +
             strlen(live_filename) + 1;
-        if_not_malloc(env_fpart_partfilename_string, malloc_size,
-            retval = 1;
-            goto cleanup;
-        )
-        snprintf(env_fpart_partfilename_string, malloc_size, "%s=%s",
-            env_fpart_partfilename_name, live_filename);
-        if(push_env(env_fpart_partfilename_string, &envp) != 0) {
-            retval = 1;
-            goto cleanup;
+        if(malloc_size > hook_env.partfilename_size) {
+            char *partfilename = realloc(hook_env.partfilename, malloc_size);
+            if(partfilename == NULL) {
+                fprintf(stderr, "%s(): cannot allocate memory\n", __func__);
+                return (1);
+            }
+            hook_env.partfilename = partfilename;
+            hook_env.partfilename_size = malloc_size;
         }
+        snprintf(hook_env.partfilename, hook_env.partfilename_size,
+            "FPART_PARTFILENAME=%s", live_filename);
+        hook_env.envp[env_index++] = hook_env.partfilename;
     }
 
     /* FPART_PARTNUMBER */
     if(live_partition_index != NULL) {
-        malloc_size = strlen(env_fpart_partnumber_name) + 1 +
-            get_num_digits(*live_partition_index) + 1;
-        if_not_malloc(env_fpart_partnumber_string, malloc_size,
-            retval = 1;
-            goto cleanup;
-        )
-        snprintf(env_fpart_partnumber_string, malloc_size, "%s=%d",
-            env_fpart_partnumber_name, *live_partition_index);
-        if(push_env(env_fpart_partnumber_string, &envp) != 0) {
-            retval = 1;
-            goto cleanup;
-        }
+        snprintf(hook_env.partnumber, sizeof(hook_env.partnumber),
+            "FPART_PARTNUMBER=%d", *live_partition_index);
+        hook_env.envp[env_index++] = hook_env.partnumber;
     }
 
     /* FPART_PARTSIZE */
     if(live_partition_size != NULL) {
-        malloc_size = strlen(env_fpart_partsize_name) + 1 +
-            get_num_digits(*live_partition_size) + 1;
-        if_not_malloc(env_fpart_partsize_string, malloc_size,
-            retval = 1;
-            goto cleanup;
-        )
-        snprintf(env_fpart_partsize_string, malloc_size, "%s=%lld",
-            env_fpart_partsize_name, *live_partition_size);
-        if(push_env(env_fpart_partsize_string, &envp) != 0) {
-            retval = 1;
-            goto cleanup;
-        }
+        snprintf(hook_env.partsize, sizeof(hook_env.partsize),
+            "FPART_PARTSIZE=%lld", *live_partition_size);
+        hook_env.envp[env_index++] = hook_env.partsize;
     }
 
     /* FPART_PARTNUMFILES */
     if(live_num_files != NULL) {
-        malloc_size = strlen(env_fpart_partnumfiles_name) + 1 +
-            get_num_digits(*live_num_files) + 1;
-        if_not_malloc(env_fpart_partnumfiles_string, malloc_size,
-            retval = 1;
-            goto cleanup;
-        )
-        snprintf(env_fpart_partnumfiles_string, malloc_size, "%s=%llu",
-            env_fpart_partnumfiles_name, *live_num_files);
-        if(push_env(env_fpart_partnumfiles_string, &envp) != 0) {
-            retval = 1;
-            goto cleanup;
-        }
+        snprintf(hook_env.partnumfiles, sizeof(hook_env.partnumfiles),
+            "FPART_PARTNUMFILES=%llu", *live_num_files);
+        hook_env.envp[env_index++] = hook_env.partnumfiles;
     }
 
     /* FPART_PID */
-    pid_t fpart_pid = getpid();
-    malloc_size = strlen(env_fpart_pid_name) + 1 +
-        get_num_digits(fpart_pid) + 1;
-    if_not_malloc(env_fpart_pid_string, malloc_size,
-        retval = 1;
-        goto cleanup;
-    )
-    snprintf(env_fpart_pid_string, malloc_size, "%s=%d",
-        env_fpart_pid_name, (int)fpart_pid);
-    if(push_env(env_fpart_pid_string, &envp) != 0) {
-        retval = 1;
-        goto cleanup;
+    hook_env.envp[env_index++] = hook_env.pid;
+    hook_env.envp[env_index] = NULL;
+
+    assert(env_index <= hook_env.base + HOOK_ENV_NUM_VARS);
+
+#if defined(HAVE_POSIX_SPAWN)
+    /* spawn child process, as process group leader */
+    posix_spawnattr_t attr;
+    posix_spawn_file_actions_t actions;
+    int err;
+
+    if((err = posix_spawnattr_init(&attr)) != 0) {
+        fprintf(stderr, "%s(): posix_spawnattr_init(): %s\n", __func__,
+            strerror(err));
+        return (1);
+    }
+    if((err = posix_spawn_file_actions_init(&actions)) != 0) {
+        fprintf(stderr, "%s(): posix_spawn_file_actions_init(): %s\n",
+            __func__, strerror(err));
+        posix_spawnattr_destroy(&attr);
+        return (1);
+    }
+
+    char *argv[] = { "sh", "-c", (char *)cmd, NULL };
+    if(((err = posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETPGROUP)) != 0) ||
+        ((err = posix_spawnattr_setpgroup(&attr, 0)) != 0) ||
+        /* redirect stdin */
+        ((in_fd >= 0) &&
+        ((err = posix_spawn_file_actions_adddup2(&actions, in_fd,
+        STDIN_FILENO)) != 0)) ||
+        /* redirect stdout and stderr to log file */
+        ((log_filename != NULL) &&
+        (((err = posix_spawn_file_actions_addopen(&actions, STDOUT_FILENO,
+        log_filename, O_WRONLY|O_CREAT|O_TRUNC, 0660)) != 0) ||
+        ((err = posix_spawn_file_actions_adddup2(&actions, STDOUT_FILENO,
+        STDERR_FILENO)) != 0))) ||
+        ((err = posix_spawn(pid, _PATH_BSHELL, &actions, &attr, argv,
+        hook_env.envp)) != 0)) {
+        fprintf(stderr, "%s(): posix_spawn(): %s\n", __func__,
+            strerror(err));
+        *pid = -1;
     }
 
+    posix_spawn_file_actions_destroy(&actions);
+    posix_spawnattr_destroy(&attr);
+    return ((*pid == -1) ? 1 : 0);
+#else
     /* fork child process */
-    int child_status = 0;
-    switch(live_status.child_pid = fork()) {
+    switch(*pid = fork()) {
         case -1:            /* error */
             fprintf(stderr, "fork(): %s\n", strerror(errno));
-            retval = 1;
-            break;
+            return (1);
         case 0:             /* child */
         {
             /* become process group leader */
-            if(setpgid(live_status.child_pid, 0) != 0) {
+            if(setpgid(0, 0) != 0) {
                 fprintf(stderr, "%s(): setpgid(): %s\n", __func__,
                     strerror(errno));
                 exit(EXIT_FAILURE);
             }
-            execle(_PATH_BSHELL, "sh", "-c", cmd, (char *)NULL, envp);
+            /* redirect stdin */
+            if((in_fd >= 0) && (dup2(in_fd, STDIN_FILENO) < 0)) {
+                fprintf(stderr, "%s(): dup2(): %s\n", __func__,
+                    strerror(errno));
+                exit(EXIT_FAILURE);
+            }
+            /* redirect stdout and stderr to log file */
+            if(log_filename != NULL) {
+                int log_fd = open(log_filename, O_WRONLY|O_CREAT|O_TRUNC,
+                    0660);
+                if((log_fd < 0) ||
+                    (dup2(log_fd, STDOUT_FILENO) < 0) ||
+                    (dup2(log_fd, STDERR_FILENO) < 0)) {
+                    fprintf(stderr, "%s: %s\n", log_filename,
+                        strerror(errno));
+                    exit(EXIT_FAILURE);
+                }
+                if(log_fd > STDERR_FILENO)
+                    close(log_fd);
+            }
+            execle(_PATH_BSHELL, "sh", "-c", cmd, (char *)NULL,
+                hook_env.envp);
             /* if reached, error */
             exit(EXIT_FAILURE);
         }
         default:            /* parent */
-        {
-            /* child-killer signal handler */
-            signal(SIGTERM, kill_child);
-            signal(SIGINT, kill_child);
-            signal(SIGHUP, kill_child);
-
-            pid_t wpid;
-            do {
-                wpid = wait(&child_status);
-            } while((wpid != live_status.child_pid) && (wpid != -1));
-
-            /* reset actions for signals */
-            signal(SIGTERM, SIG_DFL);
-            signal(SIGINT, SIG_DFL);
-            signal(SIGHUP, SIG_DFL);
-            /* reset child PID */
-            live_status.child_pid = -1;
-
-            if(wpid == -1) {
-                fprintf(stderr, "%s(): wait(): %s\n", __func__,
-                    strerror(errno));
-                retval = 1;
-            }
-            else {
-                if(WIFEXITED(child_status)) {
-                    /* collect exit code */
-                    if(WEXITSTATUS(child_status) != 0) {
-                        if(options->verbose >= OPT_VERBOSE)
-                            fprintf(stderr, "Hook '%s' exited with error %d\n",
-                                cmd, WEXITSTATUS(child_status));
-                        retval = 1;
-                    }
-                }
-                else {
-                    if(options->verbose >= OPT_VERBOSE)
-                        fprintf(stderr, "Hook '%s' terminated prematurely\n",
-                            cmd);
-                    retval = 1;
-                }
+            break;
+    }
+    return (0);
+#endif
+}
+
+/* Check a hook's exit status (as returned by wait(2))
+   - returns 0 if the hook exited with 0, else returns 1 */
+static int
+hook_status(const char *cmd, int child_status,
+    const struct program_options *options)
+{
+    assert(cmd != NULL);
+    assert(options != NULL);
+
+    if(WIFEXITED(child_status)) {
+        /* collect exit code */
+        if(WEXITSTATUS(child_status) != 0) {
+            if(options->verbose >= OPT_VERBOSE)
+                fprintf(stderr, "Hook '%s' exited with error %d\n",
+                    cmd, WEXITSTATUS(child_status));
+            return (1);
+        }
+    }
+    else {
+        if(options->verbose >= OPT_VERBOSE)
+            fprintf(stderr, "Hook '%s' terminated prematurely\n", cmd);
+        return (1);
+    }
+    return (0);
+}
+
+/* Executes 'cmd' and waits for it to terminate
+   - returns 0 if cmd has been executed and its return code was 0,
+     else returns 1 */
+int
+fpart_hook(const char *cmd, const struct program_options *options,
+    const char *live_filename, const pnum_t *live_partition_index,
+    const fsize_t *live_partition_size, const fnum_t *live_num_files)
+{
+    assert(cmd != NULL);
+    assert(options != NULL);
+
+    if(start_hook(cmd, options, live_filename, live_partition_index,
+        live_partition_size, live_num_files, -1, NULL,
+        &live_status.child_pid) != 0) {
+        live_status.child_pid = -1;
+        return (1);
+    }
+
+    /* child-killer signal handler */
+    struct sigaction sa, old_term, old_int, old_hup;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = kill_child;
+    sigemptyset(&sa.sa_mask);
+    sigaction(SIGTERM, &sa, &old_term);
+    sigaction(SIGINT, &sa, &old_int);
+    sigaction(SIGHUP, &sa, &old_hup);
+
+    int child_status = 0;
+    pid_t wpid;
+    do {
+        wpid = waitpid(live_status.child_pid, &child_status, 0);
+    } while((wpid == -1) && (errno == EINTR));
+
+    /* restore previous actions for signals (asynchronous jobs or consumers
+       may still be running, see init_live_hooks()) */
+    sigaction(SIGTERM, &old_term, NULL);
+    sigaction(SIGINT, &old_int, NULL);
+    sigaction(SIGHUP, &old_hup, NULL);
+    /* reset child PID */
+    live_status.child_pid = -1;
+
+    if(wpid == -1) {
+        fprintf(stderr, "%s(): waitpid(): %s\n", __func__, strerror(errno));
+        return (1);
+    }
+    return (hook_status(cmd, child_status, options));
+}
+
+/* Wait for an asynchronous hook to terminate (option -H) and record its exit
+   status
+   - if block is not set, return immediately if no hook has terminated
+   - returns 1 if a hook has been reaped, else 0 */
+static int
+wait_live_hook(unsigned char block, const struct program_options *options)
+{
+    assert(options != NULL);
+
+    int child_status = 0;
+    pid_t wpid;
+    unsigned int i;
+
+    while(live_status.num_hooks > 0) {
+        wpid = waitpid(-1, &child_status, block ? 0 : WNOHANG);
+        if(wpid == 0)
+            return (0);
+        if(wpid == -1) {
+            if(errno == EINTR)
+                continue;
+            fprintf(stderr, "%s(): waitpid(): %s\n", __func__,
+                strerror(errno));
+            /* hooks cannot be waited for anymore, forget them */
+            for(i = 0; i < live_status.num_hooks; i++) {
+                if(live_status.hooks[i].job_cmd != NULL)
+                    free(live_status.hooks[i].job_cmd);
             }
+            live_status.num_hooks = 0;
+            live_status.exit_summary = 1;
+            return (0);
+        }
+
+        /* hook co-process (option -P) */
+        if(wpid == live_status.coproc_pid) {
+            if(hook_status(options->hook_coproc, child_status, options) != 0)
+                live_status.exit_summary = 1;
+            live_status.coproc_pid = -1;
+            continue;
+        }
+
+        for(i = 0; i < live_status.num_hooks; i++) {
+            if(live_status.hooks[i].pid == wpid)
+                break;
+        }
+        if(i == live_status.num_hooks)
+            continue;       /* not one of our hooks */
+
+        if(hook_status((live_status.hooks[i].job_cmd != NULL) ?
+            live_status.hooks[i].job_cmd : live_status.hooks[i].cmd,
+            child_status, options) != 0)
+            live_status.exit_summary = 1;
+        if(live_status.hooks[i].job_cmd != NULL)
+            free(live_status.hooks[i].job_cmd);
+
+        /* remove hook, keeping start order */
+        live_status.num_hooks--;
+        for(; i < live_status.num_hooks; i++)
+            live_status.hooks[i] = live_status.hooks[i + 1];
+        return (1);
+    }
+    return (0);
+}
+
+/* Reap asynchronous hooks that have terminated (option -H), if any */
+static void
+reap_live_hooks(const struct program_options *options)
+{
+    assert(options != NULL);
+
+    if(!live_hooks_exited)
+        return;
+    live_hooks_exited = 0;
+    while(wait_live_hook(0, options) != 0);
+    return;
+}
+
+/* Check if asynchronous hook 'cmd' is running for partition partition_index
+   - returns 1 if it is, else 0 */
+static int
+live_hook_running(const char *cmd, pnum_t partition_index)
+{
+    unsigned int i;
+    for(i = 0; i < live_status.num_hooks; i++) {
+        if((live_status.hooks[i].cmd == cmd) &&
+            (live_status.hooks[i].partition_index == partition_index))
+            return (1);
+    }
+    return (0);
+}
+
+/* Number of asynchronous hook slots : hook_jobs with option -H, else a
+   single slot for jobs (option -C) or consumers (option -S), hooks being run
+   synchronously */
+static unsigned int
+live_hook_slots(const struct program_options *options)
+{
+    assert(options != NULL);
+
+    return ((options->hook_jobs > 0) ? options->hook_jobs : 1);
+}
+
+/* Set up asynchronous hooks' table and signal handlers (options -H, -C and
+   -S), once
+   - returns 0 (success) or 1 (failure) */
+static int
+init_live_hooks(const struct program_options *options)
+{
+    assert(options != NULL);
+
+    if(live_status.hooks != NULL)
+        return (0);
+
+    if_not_malloc(live_status.hooks,
+        sizeof(struct live_hook) * live_hook_slots(options),
+        return (1);
+    )
+    live_status.num_hooks = 0;
+
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = hook_exited;
+    sigemptyset(&sa.sa_mask);
+    sa.sa_flags = SA_RESTART | SA_NOCLDSTOP;
+    sigaction(SIGCHLD, &sa, NULL);
+
+    signal(SIGTERM, kill_child);
+    signal(SIGINT, kill_child);
+    signal(SIGHUP, kill_child);
+    return (0);
+}
+
+/* Start 'cmd' asynchronously for current partition (options -H, -C and -S),
+   once a slot is free
+   - job_cmd is the expanded command of a job (option -C, cmd being its
+     template), freed once the job has terminated ; NULL for hooks
+   - a job's output is redirected to log_filename
+   - a stream consumer's input is read from in_fd (option -S), -1 otherwise
+   - returns 0 if cmd has been started, else returns 1 */
+static int
+start_live_hook(const char *cmd, char *job_cmd, int in_fd,
+    const char *log_filename, const struct program_options *options)
+{
+    assert(cmd != NULL);
+    assert(options != NULL);
+
+    if(init_live_hooks(options) != 0)
+        return (1);
+
+    reap_live_hooks(options);
+
+    /* wait for current partition's pre-partition hook */
+    if(cmd != options->pre_part_hook) {
+        while(live_hook_running(options->pre_part_hook,
+            live_status.partition_index) &&
+            (wait_live_hook(1, options) != 0));
+    }
+
+    /* wait for a free slot */
+    while(live_status.num_hooks >= live_hook_slots(options)) {
+        if(wait_live_hook(1, options) == 0)
+            break;
+    }
+
+    pid_t pid = -1;
+    if(start_hook((job_cmd != NULL) ? job_cmd : cmd, options,
+        live_status.filename, &live_status.partition_index,
+        &live_status.partition_size, &live_status.partition_num_files,
+        in_fd, log_filename, &pid) != 0)
+        return (1);
+
+    live_status.hooks[live_status.num_hooks].pid = pid;
+    live_status.hooks[live_status.num_hooks].cmd = cmd;
+    live_status.hooks[live_status.num_hooks].job_cmd = job_cmd;
+    live_status.hooks[live_status.num_hooks].partition_index =
+        live_status.partition_index;
+    live_status.num_hooks++;
+    return (0);
+}
+
+/* Executes 'cmd' as current partition's hook
+   - with option -H, cmd is started asynchronously : at most hook_jobs hooks
+     run concurrently and a post-partition hook is only started once the
+     pre-partition hook of the same partition has terminated
+   - hooks' exit statuses are recorded in live_status.exit_summary */
+static void
+live_hook(const char *cmd, const struct program_options *options)
+{
+    assert(cmd != NULL);
+    assert(options != NULL);
+
+    if(options->hook_jobs == 0) {
+        if(fpart_hook(cmd, options, live_status.filename,
+            &live_status.partition_index, &live_status.partition_size,
+            &live_status.partition_num_files) != 0)
+            live_status.exit_summary = 1;
+        return;
+    }
+
+    if(start_live_hook(cmd, NULL, -1, NULL, options) != 0)
+        live_status.exit_summary = 1;
+    return;
+}
+
+/* Expand a job's command template (option -C) for partition file filename
+   - "%f" is replaced by filename (single-quoted for the shell), "%n" by the
+     partition number and "%%" by '%'
+   - returns a newly-allocated string or NULL if an error occurred */
+static char *
+expand_job_cmd(const char *cmd, const char *filename, pnum_t partition_index)
+{
+    assert(cmd != NULL);
+    assert(filename != NULL);
+
+    /* compute size : each quote in filename needs 4 chars ('\'') */
+    size_t filename_size = 2;
+    const char *p;
+    for(p = filename; *p != '\0'; p++)
+        filename_size += (*p == '\'') ? 4 : 1;
+    size_t malloc_size = 1;
+    for(p = cmd; *p != '\0'; p++) {
+        if((p[0] == '%') && (p[1] == 'f')) {
+            malloc_size += filename_size;
+            p++;
+        }
+        else if((p[0] == '%') && (p[1] == 'n')) {
+            malloc_size += get_num_digits(partition_index);
+            p++;
+        }
+        else
+            malloc_size++;
+    }
+
+    char *expanded = NULL;
+    if_not_malloc(expanded, malloc_size,
+        return (NULL);
+    )
+
+    char *q = expanded;
+    for(p = cmd; *p != '\0'; p++) {
+        if((p[0] == '%') && (p[1] == 'f')) {
+            const char *f;
+            *q++ = '\'';
+            for(f = filename; *f != '\0'; f++) {
+                if(*f == '\'') {
+                    memcpy(q, "'\\''", 4);
+                    q += 4;
+                }
+                else
+                    *q++ = *f;
+            }
+            *q++ = '\'';
+            p++;
+        }
+        else if((p[0] == '%') && (p[1] == 'n')) {
+            q += snprintf(q, malloc_size - (q - expanded), "%d",
+                partition_index);
+            p++;
+        }
+        else if((p[0] == '%') && (p[1] == '%')) {
+            *q++ = '%';
+            p++;
+        }
+        else
+            *q++ = *p;
+    }
+    *q = '\0';
+    return (expanded);
+}
+
+/* Start current partition's job (option -C), once its partition file has
+   been closed
+   - the job's output is logged to "out_template.i.log"
+   - jobs' exit statuses are recorded in live_status.exit_summary */
+static void
+live_job(const struct program_options *options)
+{
+    assert(options != NULL);
+    assert(options->job_cmd != NULL);
+    assert(live_status.filename != NULL);
+
+    char *job_cmd = expand_job_cmd(options->job_cmd, live_status.filename,
+        live_status.partition_index);
+    if(job_cmd == NULL) {
+        live_status.exit_summary = 1;
+        return;
+    }
+
+    size_t malloc_size = strlen(live_status.filename) + strlen(".log") + 1;
+    char *log_filename = NULL;
+    if_not_malloc(log_filename, malloc_size,
+        free(job_cmd);
+        live_status.exit_summary = 1;
+        return;
+    )
+    snprintf(log_filename, malloc_size, "%s.log", live_status.filename);
+
+    if(options->verbose >= OPT_VERBOSE)
+        fprintf(stderr, "Executing part #%d job: '%s'\n",
+            live_status.partition_index, job_cmd);
+
+    if(start_live_hook(options->job_cmd, job_cmd, -1, log_filename,
+        options) != 0) {
+        free(job_cmd);
+        live_status.exit_summary = 1;
+    }
+    free(log_filename);
+    return;
+}
+
+/* Wait for all asynchronous hooks to terminate (option -H) */
+static void
+wait_live_hooks(const struct program_options *options)
+{
+    assert(options != NULL);
+
+    if(live_status.hooks == NULL)
+        return;
+
+    while(wait_live_hook(1, options) != 0);
+
+    /* reset actions for signals */
+    signal(SIGTERM, SIG_DFL);
+    signal(SIGINT, SIG_DFL);
+    signal(SIGHUP, SIG_DFL);
+    signal(SIGCHLD, SIG_DFL);
+
+    free(live_status.hooks);
+    live_status.hooks = NULL;
+    live_status.num_hooks = 0;
+    return;
+}
+
+/* Start current partition's stream consumer (option -S) and set
+   live_status.fd to the write end of a pipe to its standard input
+   - returns 0 (success) or 1 (failure) */
+static int
+start_live_stream(const struct program_options *options)
+{
+    assert(options != NULL);
+    assert(options->stream_cmd != NULL);
+
+    int fds[2];
+    if(pipe(fds) != 0) {
+        fprintf(stderr, "%s(): pipe(): %s\n", __func__, strerror(errno));
+        return (1);
+    }
+    /* other hooks and consumers must not keep the pipe open, else the
+       consumer would never see the end of its partition */
+    fcntl(fds[0], F_SETFD, FD_CLOEXEC);
+    fcntl(fds[1], F_SETFD, FD_CLOEXEC);
+
+    if(options->verbose >= OPT_VERBOSE)
+        fprintf(stderr, "Executing part #%d consumer: '%s'\n",
+            live_status.partition_index, options->stream_cmd);
+
+    if(start_live_hook(options->stream_cmd, NULL, fds[0], NULL,
+        options) != 0) {
+        close(fds[0]);
+        close(fds[1]);
+        return (1);
+    }
+    close(fds[0]);
+    live_status.fd = fds[1];
+
+    /* a dead consumer must not kill us, writing to it fails instead */
+    signal(SIGPIPE, SIG_IGN);
+    return (0);
+}
+
+/* Start hook co-process (option -P), once
+   - the co-process reads partition events from its standard input
+   - returns 0 (success) or 1 (failure) */
+static int
+start_live_coproc(const struct program_options *options)
+{
+    assert(options != NULL);
+    assert(options->hook_coproc != NULL);
+
+    /* already started (or gone, see live_coproc_event()) */
+    if(live_status.coproc_fd != -1)
+        return (0);
+
+    int fds[2];
+    if(pipe(fds) != 0) {
+        fprintf(stderr, "%s(): pipe(): %s\n", __func__, strerror(errno));
+        return (1);
+    }
+    /* do not leak pipe's ends to other hooks (the co-process gets its own
+       copy of the read end as stdin) */
+    fcntl(fds[0], F_SETFD, FD_CLOEXEC);
+    fcntl(fds[1], F_SETFD, FD_CLOEXEC);
+
+    if(options->verbose >= OPT_VERBOSE)
+        fprintf(stderr, "Starting hook co-process: '%s'\n",
+            options->hook_coproc);
+
+    pid_t pid = -1;
+    if(start_hook(options->hook_coproc, options, NULL, NULL, NULL, NULL,
+        fds[0], NULL, &pid) != 0) {
+        close(fds[0]);
+        close(fds[1]);
+        return (1);
+    }
+    close(fds[0]);
+    live_status.coproc_pid = pid;
+    live_status.coproc_fd = fds[1];
+
+    /* a dead co-process must not kill us, see live_coproc_event() */
+    signal(SIGPIPE, SIG_IGN);
+    signal(SIGTERM, kill_child);
+    signal(SIGINT, kill_child);
+    signal(SIGHUP, kill_child);
+    return (0);
+}
+
+/* Send a partition event to hook co-process (option -P)
+   - an event is a single line (ending with a null character with option -0)
+     made of tab-separated fields : event type ("pre-part" or "post-part"),
+     partition number, partition size, number of files and partition file
+     name (empty if none)
+   - events' failures are recorded in live_status.exit_summary */
+static void
+live_coproc_event(const char *type, const struct program_options *options)
+{
+    assert(type != NULL);
+    assert(options != NULL);
+
+    if(start_live_coproc(options) != 0) {
+        live_status.exit_summary = 1;
+        return;
+    }
+    /* co-process gone, error already reported */
+    if(live_status.coproc_fd < 0)
+        return;
+
+    char header[128];
+    int header_len = snprintf(header, sizeof(header), "%s\t%d\t%lld\t%llu\t",
+        type, live_status.partition_index, live_status.partition_size,
+        live_status.partition_num_files);
+    assert((header_len > 0) && ((size_t)header_len < sizeof(header)));
+
+    char ln_term = (options->out_zero == OPT_OUT0) ? '\0' : '\n';
+    struct iovec iov[3];
+    iov[0].iov_base = header;
+    iov[0].iov_len = (size_t)header_len;
+    iov[1].iov_base = (live_status.filename != NULL) ?
+        live_status.filename : "";
+    iov[1].iov_len = strlen(iov[1].iov_base);
+    iov[2].iov_base = &ln_term;
+    iov[2].iov_len = 1;
+
+    if(writev_all(live_status.coproc_fd, iov, 3) != 0) {
+        fprintf(stderr, "Hook co-process '%s': %s\n", options->hook_coproc,
+            strerror(errno));
+        /* do not try again */
+        close(live_status.coproc_fd);
+        live_status.coproc_fd = -2;
+        live_status.exit_summary = 1;
+    }
+    return;
+}
+
+/* Stop hook co-process (option -P) : close its input and wait for it to
+   terminate */
+static void
+stop_live_coproc(const struct program_options *options)
+{
+    assert(options != NULL);
+
+    if(live_status.coproc_fd == -1)
+        return;
+    if(live_status.coproc_fd >= 0)
+        close(live_status.coproc_fd);
+    live_status.coproc_fd = -1;
+
+    /* may already have been reaped, see wait_live_hook() */
+    if(live_status.coproc_pid > 0) {
+        int child_status = 0;
+        pid_t wpid;
+        do {
+            wpid = waitpid(live_status.coproc_pid, &child_status, 0);
+        } while((wpid == -1) && (errno == EINTR));
+        if(wpid == -1) {
+            fprintf(stderr, "%s(): waitpid(): %s\n", __func__,
+                strerror(errno));
+            live_status.exit_summary = 1;
+        }
+        else if(hook_status(options->hook_coproc, child_status, options) != 0)
+            live_status.exit_summary = 1;
+        live_status.coproc_pid = -1;
+    }
+
+    /* reset actions for signals, unless asynchronous jobs may still be
+       running (see wait_live_hooks()) */
+    signal(SIGPIPE, SIG_DFL);
+    if(live_status.hooks == NULL) {
+        signal(SIGTERM, SIG_DFL);
+        signal(SIGINT, SIG_DFL);
+        signal(SIGHUP, SIG_DFL);
+    }
+    return;
+}
+
+/* Print or add a file entry (redirector)
+   - in non-live mode, store must be the main file entry store as it may be
+     flushed (see options -k and -M) */
+int
+handle_file_entry(struct file_entry_store *store, char *path, fsize_t size,
+    struct program_options *options)
+{
+    assert(options != NULL);
+
+    if(options->live_mode == OPT_LIVEMODE)
+        return (live_print_file_entry(path, size, options));
+    else {
+        if((add_file_entry(store, path, size, options) != 0) ||
+            (checkpoint_file_entries(store, options) != 0) ||
+            (extsort_spill(store, options) != 0))
+            return (1);
+        return (0);
+    }
+}
+
+/* Print a file entry */
+int
+live_print_file_entry(const char *path, fsize_t size,
+    struct program_options *options)
+{
+    assert(path != NULL);
+    assert(options != NULL);
+    assert(options->live_mode == OPT_LIVEMODE);
+
+    char *out_template = options->out_filename;
+    char *ln_term = (options->out_zero == OPT_OUT0) ? "\0" : "\n";
+
+    /* beginning of a new partition */
+    if(live_status.partition_num_files == 0) {
+        /* very first pass of first partition, preload first partition */
+        if(live_status.partition_index == 0)
+            live_status.partition_size = options->preload_size;
+
+        if(out_template != NULL) {
+            /* compute live_status.filename "out_template.i\0" */
+            size_t malloc_size = strlen(out_template) + 1 +
+                get_num_digits(live_status.partition_index) + 1;
+            if_not_malloc(live_status.filename, malloc_size,
+                return (1);
+            )
+            snprintf(live_status.filename, malloc_size, "%s.%d", out_template,
+                live_status.partition_index);
+        }
+
+        /* execute pre-partition hook */
+        if(options->pre_part_hook != NULL)
+            live_hook(options->pre_part_hook, options);
+        else if(options->hook_coproc != NULL)
+            live_coproc_event("pre-part", options);
+
+        if(options->stream_cmd != NULL) {
+            /* start consumer */
+            if(start_live_stream(options) != 0)
+                return (1);
+
+            /* allocate output buffer once, small enough for the consumer
+               to get file names while the partition is being filled */
+            if(live_status.out.data == NULL)
+                init_output_buffer(&live_status.out, PIPE_BUF);
+        }
+        else if(out_template != NULL) {
+            /* open file */
+            if((live_status.fd =
+                open(live_status.filename, O_WRONLY|O_CREAT|O_TRUNC, 0660)) < 0) {
+                fprintf(stderr, "%s: %s\n", live_status.filename,
+                    strerror(errno));
+                free(live_status.filename);
+                live_status.filename = NULL;
+                return (1);
+            }
+
+            /* allocate output buffer once */
+            if(live_status.out.data == NULL)
+                init_output_buffer(&live_status.out, OUTPUT_BUFFER_SIZE);
+        }
+    }
+
+    /* count file in */
+    live_status.partition_size +=
+        round_num(size + options->overload_size, options->round_size);
+    live_status.partition_num_files++;
+
+    if((out_template == NULL) && (options->stream_cmd == NULL)) {
+        /* no template provided, just print to stdout */
+        fprintf(stdout, "%d (%lld): %s\n", live_status.partition_index, size,
+            path);
+    }
+    else {
+        /* print to fd */
+        if(output_buffer_write(&live_status.out, live_status.fd, path,
+            strlen(path), *ln_term) != 0) {
+            fprintf(stderr, "%s\n", strerror(errno));
+            /* do not close(livefd) and free(live_status.filename) here because
+               it will be useful and free'd in uninit_file_entries() below */
+            return (1);
+        }
+    }
+
+    /* display added filename */
+    if(options->verbose >= OPT_VVERBOSE)
+        fprintf(stderr, "%s\n", path);
+
+    /* if end of partition reached */
+    if(((options->max_entries > 0) && 
+            (live_status.partition_num_files >= options->max_entries)) ||
+        ((options->max_size > 0) && 
+            (live_status.partition_size >= options->max_size))) {
+        /* display added partition */
+        if(options->verbose >= OPT_VERBOSE)
+            fprintf(stderr, "Filled part #%d: size = %lld, %lld file(s)\n",
+                live_status.partition_index, live_status.partition_size,
+                live_status.partition_num_files);
+
+        /* close fd or flush buffer */
+        if((out_template == NULL) && (options->stream_cmd == NULL))
+            fflush(stdout);
+        else {
+            if(flush_output_buffer(&live_status.out, live_status.fd) != 0) {
+                fprintf(stderr, "%s: %s\n", (live_status.filename != NULL) ?
+                    live_status.filename : options->stream_cmd,
+                    strerror(errno));
+                /* see above */
+                return (1);
+            }
+            close(live_status.fd);
+        }
+
+        /* execute post-partition hook */
+        if(options->post_part_hook != NULL)
+            live_hook(options->post_part_hook, options);
+        else if(options->hook_coproc != NULL)
+            live_coproc_event("post-part", options);
+
+        /* start partition's job */
+        if(options->job_cmd != NULL)
+            live_job(options);
+
+        if(out_template != NULL) {
+            free(live_status.filename);
+            live_status.filename = NULL;
+        }
+
+        /* reset current partition status */
+        live_status.partition_index++;
+        live_status.partition_size = options->preload_size;
+        live_status.partition_num_files = 0;
+    }
+
+    return (0);
+}
+
+/*********************************************
+ File entry store manipulation functions
+ *********************************************/
+
+/* Initialize an empty file entry store */
+void
+init_file_entry_store(struct file_entry_store *store)
+{
+    assert(store != NULL);
+
+    store->dirs = NULL;
+    store->names = NULL;
+    store->sizes = NULL;
+    store->partition_indexes = NULL;
+    store->num_entries = 0;
+    store->alloc_entries = 0;
+    store->dir_parents = NULL;
+    store->dir_names = NULL;
+    store->num_dirs = 0;
+    store->alloc_dirs = 0;
+    store->dir_buckets = NULL;
+    store->num_dir_buckets = 0;
+    store->last_dir_path = NULL;
+    store->last_dir_len = 0;
+    store->last_dir_size = 0;
+    store->last_dir = FILE_ENTRY_NO_DIR;
+    store->arena = NULL;
+    store->arena_size = 0;
+    store->map = NULL;
+    store->map_size = 0;
+    return;
+}
+
+/* Un-initialize a file entry store
+   - free path arenas and arrays, leaving an empty store */
+void
+uninit_file_entry_store(struct file_entry_store *store)
+{
+    assert(store != NULL);
+
+    struct path_arena *arena = store->arena;
+    while(arena != NULL) {
+        struct path_arena *prev = arena->prevp;
+        free(arena->data);
+        free(arena);
+        arena = prev;
+    }
+    if(store->map != NULL) {
+        /* arrays mapped from a snapshot */
+        munmap(store->map, store->map_size);
+        store->dirs = NULL;
+        store->sizes = NULL;
+        store->dir_parents = NULL;
+    }
+    if(store->dirs != NULL)
+        free(store->dirs);
+    if(store->names != NULL)
+        free(store->names);
+    if(store->sizes != NULL)
+        free(store->sizes);
+    if(store->partition_indexes != NULL)
+        free(store->partition_indexes);
+    if(store->dir_parents != NULL)
+        free(store->dir_parents);
+    if(store->dir_names != NULL)
+        free(store->dir_names);
+    if(store->dir_buckets != NULL)
+        free(store->dir_buckets);
+    if(store->last_dir_path != NULL)
+        free(store->last_dir_path);
+
+    init_file_entry_store(store);
+    return;
+}
+
+/* Make room for num_entries entries within store
+   - returns 0 (success) or 1 (failure, store left untouched) */
+static int
+grow_file_entry_store(struct file_entry_store *store, fnum_t num_entries)
+{
+    assert(store != NULL);
+
+    if(num_entries <= store->alloc_entries)
+        return (0);
+
+    fnum_t alloc_entries = (store->alloc_entries > 0) ?
+        store->alloc_entries : FILE_ENTRY_STORE_MIN_ENTRIES;
+    while(alloc_entries < num_entries)
+        alloc_entries *= 2;
+
+    fnum_t *dirs = store->dirs;
+    if_not_realloc(dirs, sizeof(fnum_t) * alloc_entries,
+        return (1);
+    )
+    store->dirs = dirs;
+
+    char **names = store->names;
+    if_not_realloc(names, sizeof(char *) * alloc_entries,
+        return (1);
+    )
+    store->names = names;
+
+    fsize_t *sizes = store->sizes;
+    if_not_realloc(sizes, sizeof(fsize_t) * alloc_entries,
+        return (1);
+    )
+    store->sizes = sizes;
+
+    pnum_t *partition_indexes = store->partition_indexes;
+    if_not_realloc(partition_indexes, sizeof(pnum_t) * alloc_entries,
+        return (1);
+    )
+    store->partition_indexes = partition_indexes;
+
+    store->alloc_entries = alloc_entries;
+    return (0);
+}
+
+/* Copy len bytes of str to store's path arenas (adding a trailing '\0'),
+   chaining a new arena chunk if needed
+   - chunks grow from PATH_ARENA_MIN_SIZE to PATH_ARENA_MAX_SIZE
+   - returns a pointer to the copy or NULL if error */
+static char *
+arena_strndup(struct file_entry_store *store, const char *str, size_t len)
+{
+    assert(store != NULL);
+    assert(str != NULL);
+
+    size_t str_size = len + 1;
+    struct path_arena *arena = store->arena;
+
+    if((arena == NULL) || ((arena->size - arena->used) < str_size)) {
+        size_t arena_size = (arena == NULL) ? PATH_ARENA_MIN_SIZE :
+            min(arena->size * 2, PATH_ARENA_MAX_SIZE);
+        arena_size = max(arena_size, str_size);
+
+        if_not_malloc(arena, sizeof(struct path_arena),
+            return (NULL);
+        )
+        if_not_malloc(arena->data, arena_size,
+            free(arena);
+            return (NULL);
+        )
+        arena->size = arena_size;
+        arena->used = 0;
+        arena->prevp = store->arena;
+        store->arena = arena;
+        store->arena_size += arena_size;
+    }
+
+    char *copy = arena->data + arena->used;
+    memcpy(copy, str, len);
+    copy[len] = '\0';
+    arena->used += str_size;
+    return (copy);
+}
+
+/* Hash a directory node (parent node, name) */
+static fnum_t
+hash_dir(fnum_t parent, const char *name, size_t len)
+{
+    /* FNV-1a */
+    fnum_t hash = 14695981039346656037ULL ^ parent;
+    size_t i;
+    for(i = 0; i < len; i++) {
+        hash ^= (unsigned char)name[i];
+        hash *= 1099511628211ULL;
+    }
+    return (hash);
+}
+
+/* Make room for one more directory node within store, re-hashing
+   directory nodes when the hash table gets half full
+   - returns 0 (success) or 1 (failure, store left untouched) */
+static int
+grow_dirs(struct file_entry_store *store)
+{
+    assert(store != NULL);
+
+    if(store->num_dirs >= store->alloc_dirs) {
+        fnum_t alloc_dirs = (store->alloc_dirs > 0) ?
+            (store->alloc_dirs * 2) : FILE_ENTRY_STORE_MIN_DIRS;
+
+        fnum_t *dir_parents = store->dir_parents;
+        if_not_realloc(dir_parents, sizeof(fnum_t) * alloc_dirs,
+            return (1);
+        )
+        store->dir_parents = dir_parents;
+
+        char **dir_names = store->dir_names;
+        if_not_realloc(dir_names, sizeof(char *) * alloc_dirs,
+            return (1);
+        )
+        store->dir_names = dir_names;
+
+        store->alloc_dirs = alloc_dirs;
+    }
+
+    if(((store->num_dirs + 1) * 2) > store->num_dir_buckets) {
+        fnum_t num_dir_buckets = (store->num_dir_buckets > 0) ?
+            (store->num_dir_buckets * 2) : (FILE_ENTRY_STORE_MIN_DIRS * 2);
+        fnum_t *dir_buckets = NULL;
+        if_not_malloc(dir_buckets, sizeof(fnum_t) * num_dir_buckets,
+            return (1);
+        )
+
+        fnum_t i;
+        for(i = 0; i < num_dir_buckets; i++)
+            dir_buckets[i] = FILE_ENTRY_NO_DIR;
+        for(i = 0; i < store->num_dirs; i++) {
+            fnum_t bucket = hash_dir(store->dir_parents[i],
+                store->dir_names[i], strlen(store->dir_names[i])) &
+                (num_dir_buckets - 1);
+            while(dir_buckets[bucket] != FILE_ENTRY_NO_DIR)
+                bucket = (bucket + 1) & (num_dir_buckets - 1);
+            dir_buckets[bucket] = i;
+        }
+
+        if(store->dir_buckets != NULL)
+            free(store->dir_buckets);
+        store->dir_buckets = dir_buckets;
+        store->num_dir_buckets = num_dir_buckets;
+    }
+    return (0);
+}
+
+/* Find or create directory node (parent, name)
+   - name is len bytes long and not necessarily '\0'-terminated
+   - if copy is not NULL, it is used as the ('\0'-terminated) name of a newly
+     created node instead of a copy of name
+   - returns 0 (success, node set) or 1 (failure) */
+static int
+intern_dir(struct file_entry_store *store, fnum_t parent, const char *name,
+    size_t len, char *copy, fnum_t *node)
+{
+    assert(store != NULL);
+    assert(name != NULL);
+    assert(node != NULL);
+
+    if(grow_dirs(store) != 0)
+        return (1);
+
+    fnum_t mask = store->num_dir_buckets - 1;
+    fnum_t bucket = hash_dir(parent, name, len) & mask;
+    while(store->dir_buckets[bucket] != FILE_ENTRY_NO_DIR) {
+        fnum_t candidate = store->dir_buckets[bucket];
+        if((store->dir_parents[candidate] == parent) &&
+            (strncmp(store->dir_names[candidate], name, len) == 0) &&
+            (store->dir_names[candidate][len] == '\0')) {
+            *node = candidate;
+            return (0);
+        }
+        bucket = (bucket + 1) & mask;
+    }
+
+    /* not found, create it */
+    if(copy == NULL) {
+        copy = arena_strndup(store, name, len);
+        if(copy == NULL)
+            return (1);
+    }
+    store->dir_parents[store->num_dirs] = parent;
+    store->dir_names[store->num_dirs] = copy;
+    store->dir_buckets[bucket] = store->num_dirs;
+    *node = store->num_dirs;
+    store->num_dirs++;
+
+    return (0);
+}
+
+/* Find or create the directory node of a directory path
+   (len bytes, not necessarily '\0'-terminated)
+   - each '/'-separated component is a directory node, the last one being
+     returned through node
+   - returns 0 (success) or 1 (failure) */
+static int
+intern_dir_path(struct file_entry_store *store, const char *path, size_t len,
+    fnum_t *node)
+{
+    assert(store != NULL);
+    assert(path != NULL);
+    assert(node != NULL);
+
+    /* same directory as previous entry (usual case when crawling) */
+    if((store->last_dir != FILE_ENTRY_NO_DIR) &&
+        (store->last_dir_len == len) &&
+        (memcmp(store->last_dir_path, path, len) == 0)) {
+        *node = store->last_dir;
+        return (0);
+    }
+
+    fnum_t current = FILE_ENTRY_NO_DIR;
+    size_t start = 0;
+    size_t i;
+    for(i = 0; i <= len; i++) {
+        if((i == len) || (path[i] == '/')) {
+            if(intern_dir(store, current, &path[start], i - start, NULL,
+                &current) != 0)
+                return (1);
+            start = i + 1;
         }
-            break;
     }
 
-cleanup:
-    if(envp != NULL)
-        free(envp);
-    if(env_fpart_hooktype_string != NULL)
-        free(env_fpart_hooktype_string);
-    if(env_fpart_partfilename_string != NULL)
-        free(env_fpart_partfilename_string);
-    if(env_fpart_partnumber_string != NULL)
-        free(env_fpart_partnumber_string);
-    if(env_fpart_partsize_string != NULL)
-        free(env_fpart_partsize_string);
-    if(env_fpart_partnumfiles_string != NULL)
-        free(env_fpart_partnumfiles_string);
-    if(env_fpart_pid_string != NULL)
-        free(env_fpart_pid_string);
-    return (retval);
+    /* remember it */
+    if(store->last_dir_size < (len + 1)) {
+        char *last_dir_path = store->last_dir_path;
+        if_not_realloc(last_dir_path, len + 1,
+            return (1);
+        )
+        store->last_dir_path = last_dir_path;
+        store->last_dir_size = len + 1;
+    }
+    memcpy(store->last_dir_path, path, len);
+    store->last_dir_path[len] = '\0';
+    store->last_dir_len = len;
+    store->last_dir = current;
+
+    *node = current;
+    return (0);
 }
 
-/* Print or add a file entry (redirector) */
+/* Push a file entry to a store, as is
+   - returns 0 (success) or 1 (failure) */
 int
-handle_file_entry(struct file_entry **head, char *path, fsize_t size,
-    struct program_options *options)
+push_file_entry(struct file_entry_store *store, const char *path,
+    fsize_t size)
 {
-    assert(options != NULL);
+    assert(store != NULL);
+    assert(store->map == NULL);
+    assert(path != NULL);
 
-    if(options->live_mode == OPT_LIVEMODE)
-        return (live_print_file_entry(path, size, options));
+    if(grow_file_entry_store(store, store->num_entries + 1) != 0)
+        return (1);
+
+    /* split path into directory node and leaf name */
+    fnum_t dir = FILE_ENTRY_NO_DIR;
+    const char *name = strrchr(path, '/');
+    if(name != NULL) {
+        if(intern_dir_path(store, path, name - path, &dir) != 0)
+            return (1);
+        name++;
+    }
     else
-        return (add_file_entry(head, path, size, options));
+        name = path;
+
+    char *copy = arena_strndup(store, name, strlen(name));
+    if(copy == NULL)
+        return (1);
+
+    store->dirs[store->num_entries] = dir;
+    store->names[store->num_entries] = copy;
+    store->sizes[store->num_entries] = size;
+    store->partition_indexes[store->num_entries] = 0; /* set during dispatch */
+    store->num_entries++;
+
+    return (0);
 }
 
-/* Print a file entry */
+/* Move src's entries to the end of dst
+   - path arenas are handed over to dst (names are not copied) and src's
+     directory nodes are interned into dst
+   - src is left empty
+   - returns 0 (success) or 1 (failure) */
 int
-live_print_file_entry(char *path, fsize_t size,
-    struct program_options *options)
+append_file_entry_store(struct file_entry_store *dst,
+    struct file_entry_store *src)
 {
-    assert(path != NULL);
-    assert(options != NULL);
-    assert(options->live_mode == OPT_LIVEMODE);
-
-    char *out_template = options->out_filename;
-    char *ln_term = (options->out_zero == OPT_OUT0) ? "\0" : "\n";
+    assert(dst != NULL);
+    assert(src != NULL);
 
-    /* beginning of a new partition */
-    if(live_status.partition_num_files == 0) {
-        /* very first pass of first partition, preload first partition */
-        if(live_status.partition_index == 0)
-            live_status.partition_size = options->preload_size;
+    if(src->num_entries == 0) {
+        uninit_file_entry_store(src);
+        return (0);
+    }
 
-        if(out_template != NULL) {
-            /* compute live_status.filename "out_template.i\0" */
-            size_t malloc_size = strlen(out_template) + 1 +
-                get_num_digits(live_status.partition_index) + 1;
-            if_not_malloc(live_status.filename, malloc_size,
-                return (1);
-            )
-            snprintf(live_status.filename, malloc_size, "%s.%d", out_template,
-                live_status.partition_index);
-        }
+    if(grow_file_entry_store(dst, dst->num_entries + src->num_entries) != 0)
+        return (1);
 
-        /* execute pre-partition hook */
-        if(options->pre_part_hook != NULL) {
-            if(fpart_hook(options->pre_part_hook, options, live_status.filename,
-                &live_status.partition_index, &live_status.partition_size,
-                &live_status.partition_num_files) != 0)
-                live_status.exit_summary = 1;
+    /* hand src's arenas over to dst (appended after dst's current chunk to
+       keep filling it first) */
+    if(src->arena != NULL) {
+        struct path_arena *oldest = src->arena;
+        while(oldest->prevp != NULL)
+            oldest = oldest->prevp;
+        if(dst->arena != NULL) {
+            oldest->prevp = dst->arena->prevp;
+            dst->arena->prevp = src->arena;
         }
+        else
+            dst->arena = src->arena;
+        dst->arena_size += src->arena_size;
+        src->arena = NULL;
+        src->arena_size = 0;
+    }
 
-        if(out_template != NULL) {
-            /* open file */
-            if((live_status.fd =
-                open(live_status.filename, O_WRONLY|O_CREAT|O_TRUNC, 0660)) < 0) {
-                fprintf(stderr, "%s: %s\n", live_status.filename,
-                    strerror(errno));
-                free(live_status.filename);
-                live_status.filename = NULL;
-                return (1);
-            }
+    /* map src's directory nodes to dst's ones ; parents are always created
+       before their children */
+    fnum_t *dir_map = NULL;
+    if(src->num_dirs > 0) {
+        if_not_malloc(dir_map, sizeof(fnum_t) * src->num_dirs,
+            return (1);
+        )
+    }
+    fnum_t i;
+    for(i = 0; i < src->num_dirs; i++) {
+        fnum_t parent = src->dir_parents[i];
+        if(parent != FILE_ENTRY_NO_DIR)
+            parent = dir_map[parent];
+        if(intern_dir(dst, parent, src->dir_names[i],
+            strlen(src->dir_names[i]), src->dir_names[i], &dir_map[i]) != 0) {
+            free(dir_map);
+            return (1);
         }
     }
 
-    /* count file in */
-    live_status.partition_size +=
-        round_num(size + options->overload_size, options->round_size);
-    live_status.partition_num_files++;
+    for(i = 0; i < src->num_entries; i++)
+        dst->dirs[dst->num_entries + i] =
+            (src->dirs[i] != FILE_ENTRY_NO_DIR) ?
+            dir_map[src->dirs[i]] : FILE_ENTRY_NO_DIR;
+    memcpy(&dst->names[dst->num_entries], src->names,
+        sizeof(char *) * src->num_entries);
+    memcpy(&dst->sizes[dst->num_entries], src->sizes,
+        sizeof(fsize_t) * src->num_entries);
+    memcpy(&dst->partition_indexes[dst->num_entries], src->partition_indexes,
+        sizeof(pnum_t) * src->num_entries);
+    dst->num_entries += src->num_entries;
+
+    if(dir_map != NULL)
+        free(dir_map);
+    uninit_file_entry_store(src);
+    return (0);
+}
 
-    if(out_template == NULL) {
-        /* no template provided, just print to stdout */
-        fprintf(stdout, "%d (%lld): %s\n", live_status.partition_index, size,
-            path);
-    }
-    else {
-        /* print to fd */
-        size_t to_write = strlen(path);
-        if((write(live_status.fd, path, to_write) != (ssize_t)to_write) ||
-            (write(live_status.fd, ln_term, 1) != 1)) {
-            fprintf(stderr, "%s\n", strerror(errno));
-            /* do not close(livefd) and free(live_status.filename) here because
-               it will be useful and free'd in uninit_file_entries() below */
+/* Return the (approximate) amount of memory used by store, in bytes */
+size_t
+get_file_entry_store_size(struct file_entry_store *store)
+{
+    assert(store != NULL);
+
+    return ((store->alloc_entries * (sizeof(fnum_t) + sizeof(char *) +
+        sizeof(fsize_t) + sizeof(pnum_t))) +
+        (store->alloc_dirs * (sizeof(fnum_t) + sizeof(char *))) +
+        (store->num_dir_buckets * sizeof(fnum_t)) +
+        store->last_dir_size + store->arena_size);
+}
+
+/* Remove entries dispatched to partitions lower than first_part from store
+   - remaining entries are copied to a fresh store, releasing memory used by
+     removed ones (path arenas and directory nodes)
+   - returns 0 (success) or 1 (failure, store left untouched) */
+int
+trim_file_entry_store(struct file_entry_store *store, pnum_t first_part)
+{
+    assert(store != NULL);
+
+    struct file_entry_store trimmed;
+    struct path_buffer buf;
+    const char *path;
+    fnum_t i;
+
+    init_file_entry_store(&trimmed);
+    init_path_buffer(&buf);
+
+    for(i = 0; i < store->num_entries; i++) {
+        if(store->partition_indexes[i] < first_part)
+            continue;
+        if(((path = get_file_entry_path(store, i, &buf, NULL)) == NULL) ||
+            (push_file_entry(&trimmed, path, store->sizes[i]) != 0)) {
+            uninit_path_buffer(&buf);
+            uninit_file_entry_store(&trimmed);
             return (1);
         }
+        trimmed.partition_indexes[trimmed.num_entries - 1] =
+            store->partition_indexes[i];
     }
 
-    /* display added filename */
-    if(options->verbose >= OPT_VVERBOSE)
-        fprintf(stderr, "%s\n", path);
+    uninit_path_buffer(&buf);
+    uninit_file_entry_store(store);
+    *store = trimmed;
+    return (0);
+}
 
-    /* if end of partition reached */
-    if(((options->max_entries > 0) && 
-            (live_status.partition_num_files >= options->max_entries)) ||
-        ((options->max_size > 0) && 
-            (live_status.partition_size >= options->max_size))) {
-        /* display added partition */
-        if(options->verbose >= OPT_VERBOSE)
-            fprintf(stderr, "Filled part #%d: size = %lld, %lld file(s)\n",
-                live_status.partition_index, live_status.partition_size,
-                live_status.partition_num_files);
+/* Initialize an empty path buffer */
+void
+init_path_buffer(struct path_buffer *buf)
+{
+    assert(buf != NULL);
 
-        /* close fd or flush buffer */
-        if(out_template == NULL)
-            fflush(stdout);
-        else
-            close(live_status.fd);
+    buf->data = NULL;
+    buf->size = 0;
+    buf->dir = FILE_ENTRY_NO_DIR;
+    buf->dir_len = 0;
+    return;
+}
 
-        /* execute post-partition hook */
-        if(options->post_part_hook != NULL) {
-            if(fpart_hook(options->post_part_hook, options,
-                live_status.filename, &live_status.partition_index,
-                &live_status.partition_size,
-                &live_status.partition_num_files) != 0)
-                live_status.exit_summary = 1;
-        }
+/* Un-initialize a path buffer */
+void
+uninit_path_buffer(struct path_buffer *buf)
+{
+    assert(buf != NULL);
 
-        if(out_template != NULL) {
-            free(live_status.filename);
-            live_status.filename = NULL;
-        }
+    if(buf->data != NULL)
+        free(buf->data);
+    init_path_buffer(buf);
+    return;
+}
 
-        /* reset current partition status */
-        live_status.partition_index++;
-        live_status.partition_size = options->preload_size;
-        live_status.partition_num_files = 0;
+/* Rebuild the path of entry index from store
+   - the directory part is kept in buf and only rebuilt when it changes
+   - returns a pointer to the path (valid until next call) and its length
+     through len (if not NULL), or NULL if an error occurred */
+const char *
+get_file_entry_path(struct file_entry_store *store, fnum_t index,
+    struct path_buffer *buf, size_t *len)
+{
+    assert(store != NULL);
+    assert(index < store->num_entries);
+    assert(buf != NULL);
+
+    fnum_t dir = store->dirs[index];
+    const char *name = store->names[index];
+    size_t name_len = strlen(name);
+
+    /* no directory part */
+    if(dir == FILE_ENTRY_NO_DIR) {
+        if(len != NULL)
+            *len = name_len;
+        return (name);
     }
 
-    return (0);
-}
+    /* compute directory part length if it changed */
+    size_t dir_len = buf->dir_len;
+    fnum_t node;
+    if(dir != buf->dir) {
+        dir_len = 0;
+        for(node = dir; node != FILE_ENTRY_NO_DIR;
+            node = store->dir_parents[node])
+            dir_len += strlen(store->dir_names[node]) + 1;
+        buf->dir = FILE_ENTRY_NO_DIR;
+    }
+
+    /* make room for path */
+    if(buf->size < (dir_len + name_len + 1)) {
+        size_t size = max(dir_len + name_len + 1, buf->size * 2);
+        char *data = buf->data;
+        if_not_realloc(data, size,
+            return (NULL);
+        )
+        buf->data = data;
+        buf->size = size;
+    }
+
+    /* rebuild directory part, from the end */
+    if(dir != buf->dir) {
+        size_t pos = dir_len;
+        for(node = dir; node != FILE_ENTRY_NO_DIR;
+            node = store->dir_parents[node]) {
+            size_t node_len = strlen(store->dir_names[node]);
+            pos--;
+            buf->data[pos] = '/';
+            pos -= node_len;
+            memcpy(&buf->data[pos], store->dir_names[node], node_len);
+        }
+        assert(pos == 0);
+        buf->dir = dir;
+        buf->dir_len = dir_len;
+    }
 
-/*********************************************************
- Double-linked list of file_entries manipulation functions
- *********************************************************/
+    memcpy(&buf->data[dir_len], name, name_len + 1);
+    if(len != NULL)
+        *len = dir_len + name_len;
+    return (buf->data);
+}
 
-/* Add a file entry to a double-linked list of file_entries
-   - if head is NULL, creates a new file entry ; if not, chains a new file
-     entry to it
-   - returns with head set to the newly added element */
+/* Add a file entry to a store
+   - entry size is overloaded and rounded as requested */
 int
-add_file_entry(struct file_entry **head, char *path, fsize_t size,
+add_file_entry(struct file_entry_store *store, char *path, fsize_t size,
     struct program_options *options)
 {
-    assert(head != NULL);
+    assert(store != NULL);
     assert(path != NULL);
     assert(options != NULL);
     assert(options->live_mode == OPT_NOLIVEMODE);
 
-    struct file_entry **current = head; /* current file_entry pointer address */
-    struct file_entry *previous = NULL; /* previous file_entry pointer */
-
-    /* backup current structure pointer and initialize a new structure */
-    previous = *current;
-
-    if_not_malloc(*current, sizeof(struct file_entry),
-        return (1);
-    )
-
-    /* set head on first call */
-    if(*head == NULL)
-        *head = *current;
-
-    /* set current file data */
-    size_t malloc_size = strlen(path) + 1;
+    fsize_t entry_size =
+        round_num(size + options->overload_size, options->round_size);
 
-    if_not_malloc((*current)->path, malloc_size,
-        free(*current);
-        *current = previous;
+    if(push_file_entry(store, path, entry_size) != 0)
         return (1);
-    )
-    snprintf((*current)->path, malloc_size, "%s", path);
-    (*current)->size = size + options->overload_size;
-    (*current)->size = round_num((*current)->size, options->round_size);
-
-    /* set current file entry's index and pointers */
-    (*current)->partition_index = 0;    /* set during dispatch */
-    (*current)->nextp = NULL;           /* set in next pass (see below) */
-    (*current)->prevp = previous;
-
-    /* set previous' nextp pointer */
-    if(previous != NULL)
-        previous->nextp = *current;
 
     /* display added filename */
     if(options->verbose >= OPT_VVERBOSE)
-        fprintf(stderr, "%s\n", (*current)->path);
+        fprintf(stderr, "%s\n", path);
 
     return (0);
 }
@@ -591,21 +1922,58 @@ fts_dirsfirst(const FTSENT * const *a, const FTSENT * const *b)
             return (0);
 }
 
-/* Initialize a double-linked list of file_entries from a path
+/* Add or display a file entry found while crawling
+   - when working within a crawling task, hand it over to the crawler
+   - else, increments *count if the entry has been added */
+static int
+walk_handle_file_entry(struct crawl_task *task, struct file_entry_store *store,
+    fnum_t *count, char *path, fsize_t size, struct program_options *options)
+{
+    if(task != NULL)
+        return (crawl_add_file_entry(task, path, size, options));
+
+    if(handle_file_entry(store, path, size, options) != 0)
+        return (1);
+    (*count)++;
+    return (0);
+}
+
+/* Add file entries found from a path to a store
    - file_path may be a file or directory
-   - if head is NULL, creates a new list ; if not, chains a new list to it
    - increments *count with the number of files found
-   - returns != 0 if critical error
-   - returns with head set to the last element added */
+   - returns != 0 if critical error */
 int
-init_file_entries(char *file_path, struct file_entry **head, fnum_t *count,
-    struct program_options *options)
+init_file_entries(char *file_path, struct file_entry_store *store,
+    fnum_t *count, struct program_options *options)
 {
     assert(file_path != NULL);
-    assert(head != NULL);
+    assert(store != NULL);
     assert(count != NULL);
     assert(options != NULL);
 
+    /* use crawling threads, if any */
+    if(crawl_active())
+        return (crawl_file_entries(file_path, store, count, options));
+
+    return (walk_file_entries(file_path, NULL, store, count, options));
+}
+
+/* Crawl file_path and add or display file entries found
+   - when task is NULL, works as described in init_file_entries()
+   - else, file_path is a sub-tree of the original crawl: entries are handed
+     over to the crawler (store and count are unused) and sub-trees may be
+     queued for other threads
+   - returns != 0 if critical error */
+int
+walk_file_entries(char *file_path, struct crawl_task *task,
+    struct file_entry_store *store, fnum_t *count,
+    struct program_options *options)
+{
+    assert(file_path != NULL);
+    assert((task != NULL) || (store != NULL));
+    assert((task != NULL) || (count != NULL));
+    assert(options != NULL);
+
     /* prepare fts */
     FTS *ftsp = NULL;
     FTSENT *p = NULL;
@@ -613,6 +1981,11 @@ init_file_entries(char *file_path, struct file_entry **head, fnum_t *count,
         FTS_LOGICAL : FTS_PHYSICAL;
     fts_options |= (options->cross_fs_boundaries == OPT_NOCROSSFSBOUNDARIES) ?
         FTS_XDEV : 0;
+    /* threads share the same cwd */
+    fts_options |= (options->num_jobs > 1) ? FTS_NOCHDIR : 0;
+
+    /* level of file_path within the original crawl */
+    long base_level = (task != NULL) ? task->base_level : 0;
 
     char *fts_argv[] = { file_path, NULL };
 
@@ -632,6 +2005,9 @@ init_file_entries(char *file_path, struct file_entry **head, fnum_t *count,
         fprintf(stderr, "%s: fts_open()\n", file_path);
         return (0);
     }
+#if defined(EMBED_FTS)
+    cache_fts(ftsp);
+#endif
 
     /* current dir state */
     unsigned char file_as_argument = 1; /* by default, we assume file_path
@@ -642,7 +2018,37 @@ init_file_entries(char *file_path, struct file_entry **head, fnum_t *count,
     unsigned char curdir_addme = 0;     /* current dir must be added */
     fsize_t curdir_size = 0;            /* current dir size */
 
+    /* directory packed because of option -d */
+    long subtree_level = -1;            /* its level (-1 if none) */
+    fsize_t subtree_size = 0;           /* its recursive size */
+
     while((p = fts_read(ftsp)) != NULL) {
+        /* within a directory packed because of option -d, descendants are
+           not added : only sum up regular files' sizes */
+        if((subtree_level >= 0) && (p->fts_level > subtree_level)) {
+            switch (p->fts_info) {
+                case FTS_DNR:
+                case FTS_ERR:
+                case FTS_NS:
+                    fprintf(stderr, "%s: %s\n", p->fts_path,
+                        strerror(p->fts_errno));
+                    continue;
+
+                case FTS_DC:
+                    fprintf(stderr, "%s: filesystem loop detected\n",
+                        p->fts_path);
+                    continue;
+
+                case FTS_F:
+                    subtree_size += p->fts_statp->st_size;
+                    continue;
+
+                /* skip everything else (only count regular files' size) */
+                default:
+                    continue;
+            }
+        }
+
         switch (p->fts_info) {
             /* misc errors */
             case FTS_ERR:
@@ -656,6 +2062,10 @@ init_file_entries(char *file_path, struct file_entry **head, fnum_t *count,
             {
                 fprintf(stderr, "%s: %s\n", p->fts_path,
                     strerror(p->fts_errno));
+                /* directory packed because of option -d, add it anyway
+                   (with a size of 0) */
+                if(p->fts_level == subtree_level)
+                    goto add_directory;
                 /* if requested by the -zz option,
                    add directory anyway by simulating FTS_DP */
                 if(options->dirs_include >= OPT_DNREMPTY) {
@@ -682,6 +2092,13 @@ init_file_entries(char *file_path, struct file_entry **head, fnum_t *count,
 
             case FTS_DP:
             {
+                /* sub-tree handed over to another thread, only reset
+                   parent dir state */
+                if(p->fts_number == WALK_SPLIT)
+                    goto reset_directory;
+                /* filesystem loop, left untouched */
+                if(p->fts_number == WALK_LOOP)
+                    continue;
 add_directory:
                 /* if dirs_only mode activated or
                    leaf_dirs mode activated and current directory is a leaf or
@@ -693,8 +2110,8 @@ add_directory:
 
                 /* if current directory has not been added by previous rules
                    but we request all directory entries, we fake an empty dir
-                   to avoid a call to get_size() below as we want it with a
-                   size of 0 */
+                   to avoid using its recursive size below as we want it with
+                   a size of 0 */
                 if((!curdir_addme) && (options->dirs_include >= OPT_ALLDIRS)) {
                     curdir_addme = 1;
                     curdir_empty = 1;
@@ -705,8 +2122,10 @@ add_directory:
                     char *curdir_entry_path = NULL;
 
                     /* check for name validity regarding include/exclude
-                       options */
-                    if(!valid_file(p, options, 1)) {
+                       options (unless already done by parent task) */
+                    if(((task == NULL) || !task->packed ||
+                        (p->fts_level != FTS_ROOTLEVEL)) &&
+                        !valid_file(p, options, 1)) {
                         if(options->verbose >= OPT_VERBOSE)
                             fprintf(stderr, "Skipping directory: '%s'\n",
                                 p->fts_path);
@@ -748,17 +2167,14 @@ add_directory:
                            leaf_dirs mode activated and current directory is a
                            leaf, then we can use curdir_size.
                            In all other cases (e.g. when dir_depth requested and
-                           reached), we must compute the directory size
-                           recursively. */
-                        curdir_size =
-                            get_size(p->fts_accpath, p->fts_statp, options);
+                           reached), use the recursive size computed while
+                           crawling the sub-tree. */
+                        curdir_size = subtree_size;
                     /* else, trust curdir_size and leave it untouched */
 
                     /* add or display it */
-                    if(handle_file_entry
-                        (head, curdir_entry_path, curdir_size, options) == 0)
-                        (*count)++;
-                    else {
+                    if(walk_handle_file_entry(task, store, count,
+                        curdir_entry_path, curdir_size, options) != 0) {
                         fprintf(stderr, "%s(): cannot add file entry\n",
                             __func__);
                         free(curdir_entry_path);
@@ -776,17 +2192,35 @@ reset_directory:
                 curdir_dirsfound = 1;
                 curdir_addme = 0;
                 curdir_size = 0;
+                subtree_level = -1;
+                subtree_size = 0;
                 continue;
             }
 
             case FTS_D:
             {
+                p->fts_number = WALK_NONE;
+
+                /* loop not seen by fts(3), see crawl_loop_detected() */
+                if((task != NULL) &&
+                    (options->follow_symbolic_links == OPT_FOLLOWSYMLINKS) &&
+                    crawl_loop_detected(task, p)) {
+                    fprintf(stderr, "%s: filesystem loop detected\n",
+                        p->fts_path);
+                    fts_set(ftsp, p, FTS_SKIP);
+                    p->fts_number = WALK_LOOP;
+                    continue;
+                }
+
                 file_as_argument = 0; /* argument was not a file */
                 curdir_empty = 1; /* enter directory, mark it as empty */
                 curdir_dirsfound = 0; /* no dirs found yet */
 
-                /* check for name validity regarding exclude options */
-                if(!valid_file(p, options, 0)) {
+                /* check for name validity regarding exclude options
+                   (unless already done by parent task) */
+                if(((task == NULL) || (task->base_level == 0) ||
+                    (p->fts_level != FTS_ROOTLEVEL)) &&
+                    !valid_file(p, options, 0)) {
                     if(options->verbose >= OPT_VERBOSE)
                         fprintf(stderr, "Skipping directory: '%s'\n",
                             p->fts_path);
@@ -794,16 +2228,34 @@ reset_directory:
                     continue;
                 }
 
-                /* if dir_depth requested and reached,
-                   skip descendants but add directory entry (in post order) */
+                /* if dir_depth requested and reached, only compute the
+                   recursive size of descendants (see above) and add directory
+                   entry (in post order) */
                 if((options->dir_depth != OPT_NODIRDEPTH) &&
-                    (p->fts_level >= options->dir_depth)) {
-                    fts_set(ftsp, p, FTS_SKIP);
+                    ((base_level + p->fts_level) >= options->dir_depth)) {
+                    /* hand it over to another thread, if possible (once
+                       validated as a leaf, as sub-tasks' root names are
+                       full paths) */
+                    if((task != NULL) && valid_file(p, options, 1) &&
+                        (crawl_split(task, p, 1, options) == 0)) {
+                        fts_set(ftsp, p, FTS_SKIP);
+                        p->fts_number = WALK_SPLIT;
+                        continue;
+                    }
+                    subtree_level = p->fts_level;
+                    subtree_size = 0;
                     curdir_addme = 1;
                     /* as we have not crawled into this directory yet,
-                       remove the empty flag to allow a call to get_size() in
-                       FTS_DP */
+                       remove the empty flag to allow using its recursive size
+                       in FTS_DP */
                     curdir_empty = 0;
+                    continue;
+                }
+
+                /* hand sub-tree over to another thread, if possible */
+                if((task != NULL) && (crawl_split(task, p, 0, options) == 0)) {
+                    fts_set(ftsp, p, FTS_SKIP);
+                    p->fts_number = WALK_SPLIT;
                 }
                 continue;
             }
@@ -825,7 +2277,7 @@ reset_directory:
                    size. We must have visited all directories first for that
                    total to be right ; this is achieved by using a compar()
                    function with fts_open() */
-                curfile_size = get_size(p->fts_accpath, p->fts_statp, options);
+                curfile_size = get_size(p->fts_statp);
 
                 curdir_empty = 0; /* mark current dir as non empty */
                 curdir_size += curfile_size;
@@ -842,10 +2294,8 @@ reset_directory:
                     continue;
 
                 /* add or display it */
-                if(handle_file_entry
-                    (head, p->fts_path, curfile_size, options) == 0)
-                    (*count)++;
-                else {
+                if(walk_handle_file_entry(task, store, count,
+                    p->fts_path, curfile_size, options) != 0) {
                     fprintf(stderr, "%s(): cannot add file entry\n", __func__);
                     fts_close(ftsp);
                     return (1);
@@ -867,26 +2317,16 @@ reset_directory:
     return (0);
 }
 
-/* Un-initialize a double-linked list of file_entries */
+/* Un-initialize file entries
+   - free store and terminate live mode */
 void
-uninit_file_entries(struct file_entry *head, struct program_options *options)
+uninit_file_entries(struct file_entry_store *store,
+    struct program_options *options)
 {
+    assert(store != NULL);
     assert(options != NULL);
 
-    /* be sure to start from last file entry */
-    fastfw_list(head);
-
-    struct file_entry *current = head;
-    struct file_entry *prev = NULL;
-
-    while(current != NULL) {
-        if(current->path != NULL) {
-            free(current->path);
-        }
-        prev = current->prevp;
-        free(current);
-        current = prev;
-    }
+    uninit_file_entry_store(store);
 
     /* live mode */
     if(options->live_mode == OPT_LIVEMODE) {
@@ -897,22 +2337,47 @@ uninit_file_entries(struct file_entry *head, struct program_options *options)
                 live_status.partition_index, live_status.partition_size,
                 live_status.partition_num_files);
 
-        /* flush buffer or close last file if necessary */
-        if(options->out_filename == NULL)
+        /* flush buffer or close last file (or stream) if necessary */
+        if(options->stream_cmd != NULL) {
+            if(live_status.partition_num_files > 0) {
+                if(flush_output_buffer(&live_status.out, live_status.fd) != 0)
+                    fprintf(stderr, "%s: %s\n", options->stream_cmd,
+                        strerror(errno));
+                close(live_status.fd);
+            }
+        }
+        else if(options->out_filename == NULL)
             fflush(stdout);
-        else if(live_status.filename != NULL)
+        else if(live_status.filename != NULL) {
+            if(flush_output_buffer(&live_status.out, live_status.fd) != 0)
+                fprintf(stderr, "%s: %s\n", live_status.filename,
+                    strerror(errno));
             close(live_status.fd);
+        }
+        uninit_output_buffer(&live_status.out);
 
         /* execute last post-partition hook */
-        if((options->post_part_hook != NULL) &&
-            (live_status.partition_num_files > 0)) {
-            if(fpart_hook(options->post_part_hook, options,
-                live_status.filename, &live_status.partition_index,
-                &live_status.partition_size,
-                &live_status.partition_num_files) != 0)
-                live_status.exit_summary = 1;
+        if(live_status.partition_num_files > 0) {
+            if(options->post_part_hook != NULL)
+                live_hook(options->post_part_hook, options);
+            else if(options->hook_coproc != NULL)
+                live_coproc_event("post-part", options);
         }
 
+        /* start last partition's job */
+        if((options->job_cmd != NULL) && (live_status.filename != NULL) &&
+            (live_status.partition_num_files > 0))
+            live_job(options);
+
+        /* stop hook co-process (option -P) */
+        stop_live_coproc(options);
+
+        /* wait for asynchronous hooks, jobs and consumers (option -H) */
+        wait_live_hooks(options);
+        if(options->stream_cmd != NULL)
+            signal(SIGPIPE, SIG_DFL);
+        uninit_hook_env();
+
         if(live_status.filename != NULL) {
             free(live_status.filename);
             live_status.filename = NULL;
@@ -926,121 +2391,162 @@ uninit_file_entries(struct file_entry *head, struct program_options *options)
     return;
 }
 
-/* Print a double-linked list of file_entries from head
+/* Print file entries from a store
+   - only partitions first_part to (first_part + num_parts - 1) are printed,
+     entries belonging to other partitions are ignored
+   - if append is set, partition files are appended to instead of truncated
    - if no filename template given, print to stdout */
 int
-print_file_entries(struct file_entry *head, pnum_t num_parts,
-    struct program_options *options)
+print_file_entries(struct file_entry_store *store, pnum_t first_part,
+    pnum_t num_parts, int append, struct program_options *options)
 {
-    assert(head != NULL);
+    assert(store != NULL);
     assert(num_parts > 0);
     assert(options != NULL);
 
     char *out_template = options->out_filename;
     char *ln_term = (options->out_zero == OPT_OUT0) ? "\0" : "\n";
+    struct path_buffer buf;
+    const char *path;
+    size_t path_len;
+    fnum_t i;
+
+    init_path_buffer(&buf);
 
     /* no template provided, just print to stdout and return */
     if(out_template == NULL) {
-        while(head != NULL) {
-            fprintf(stdout, "%d (%lld): %s\n", head->partition_index,
-                head->size, head->path);
-            head = head->nextp;
+        for(i = 0; i < store->num_entries; i++) {
+            if((store->partition_indexes[i] < first_part) ||
+                (store->partition_indexes[i] >= (first_part + num_parts)))
+                continue;
+            if((path = get_file_entry_path(store, i, &buf, NULL)) == NULL) {
+                uninit_path_buffer(&buf);
+                return (1);
+            }
+            fprintf(stdout, "%d (%lld): %s\n", store->partition_indexes[i],
+                store->sizes[i], path);
         }
+        uninit_path_buffer(&buf);
         return (0);
     }
 
-    /* a template has been provided; to avoid opening too many files,
-       open chunks of FDs and do as many passes as necessary */
-    struct file_entry *start = head;
-    pnum_t current_chunk = 0;           /* current chunk */
-    pnum_t current_file_entry = 0;      /* current file entry within chunk */
-
-    assert(PRINT_FE_CHUNKS > 0);
-
-    while(((current_chunk * PRINT_FE_CHUNKS) + current_file_entry) <
-        num_parts) {
-        int fd[PRINT_FE_CHUNKS]; /* our <files per chunk> file descriptors */
-
-        /* open as necessary file descriptors as needed
-           to print num_part partitions */
-        while((current_file_entry < PRINT_FE_CHUNKS) &&
-              (((current_chunk * PRINT_FE_CHUNKS) + current_file_entry) < num_parts)) {
-            /* compute out_filename  "out_template.i\0" */
-            char *out_filename = NULL;
-            size_t malloc_size = strlen(out_template) + 1 + get_num_digits
-                ((current_chunk * PRINT_FE_CHUNKS) + current_file_entry) + 1;
-            if_not_malloc(out_filename, malloc_size,
-                /* close all open descriptors and return */
-                pnum_t i;
-                for(i = 0; i < current_file_entry; i++)
-                     close(fd[i]);
-                return (1);
-            )
-            snprintf(out_filename, malloc_size, "%s.%d", out_template,
-                (current_chunk * PRINT_FE_CHUNKS) + current_file_entry);
-
-            if((fd[current_file_entry] =
-                open(out_filename, O_WRONLY|O_CREAT|O_TRUNC, 0660)) < 0) {
-                fprintf(stderr, "%s: %s\n", out_filename, strerror(errno));
-                free(out_filename);
-                /* close all open descriptors and return */
-                pnum_t i;
-                for(i = 0; i < current_file_entry; i++)
-                     close(fd[i]);
-                return (1);
-            }
+    /* a template has been provided; group entries by partition (counting
+       sort) so that each partition file is opened and written only once,
+       with a single pass over entries */
+    fnum_t *ends = NULL;                /* end of each partition in order */
+    fnum_t *order = NULL;               /* entries sorted by partition */
+    fnum_t num_entries = 0;             /* entries within partition range */
+    pnum_t partition_index;
+    struct output_buffer out;
+    int retval = 0;
+
+    if_not_malloc(ends, sizeof(fnum_t) * num_parts,
+        uninit_path_buffer(&buf);
+        return (1);
+    )
+    memset(ends, 0, sizeof(fnum_t) * num_parts);
+    init_output_buffer(&out, OUTPUT_BUFFER_SIZE);
+
+    for(i = 0; i < store->num_entries; i++) {
+        if((store->partition_indexes[i] < first_part) ||
+            (store->partition_indexes[i] >= (first_part + num_parts)))
+            continue;
+        ends[store->partition_indexes[i] - first_part]++;
+        num_entries++;
+    }
+
+    if(num_entries > 0) {
+        if_not_malloc(order, sizeof(fnum_t) * num_entries,
+            retval = 1;
+            goto cleanup;
+        )
+    }
+
+    /* turn counts into start offsets, then fill order ; once filled, each
+       offset points to the end of its partition */
+    fnum_t offset = 0;
+    for(partition_index = 0; partition_index < num_parts; partition_index++) {
+        fnum_t count = ends[partition_index];
+        ends[partition_index] = offset;
+        offset += count;
+    }
+    for(i = 0; i < store->num_entries; i++) {
+        if((store->partition_indexes[i] < first_part) ||
+            (store->partition_indexes[i] >= (first_part + num_parts)))
+            continue;
+        order[ends[store->partition_indexes[i] - first_part]++] = i;
+    }
+
+    /* write partitions, one at a time */
+    fnum_t first_entry = 0;
+    for(partition_index = 0; partition_index < num_parts; partition_index++) {
+        /* compute out_filename  "out_template.i\0" */
+        char *out_filename = NULL;
+        size_t malloc_size = strlen(out_template) + 1 +
+            get_num_digits(first_part + partition_index) + 1;
+        if_not_malloc(out_filename, malloc_size,
+            retval = 1;
+            goto cleanup;
+        )
+        snprintf(out_filename, malloc_size, "%s.%d", out_template,
+            first_part + partition_index);
+
+        int fd;
+        if((fd = open(out_filename, O_WRONLY|O_CREAT|
+            (append ? O_APPEND : O_TRUNC), 0660)) < 0) {
+            fprintf(stderr, "%s: %s\n", out_filename, strerror(errno));
             free(out_filename);
-            current_file_entry++;
+            retval = 1;
+            goto cleanup;
         }
-
-        while(head != NULL) {
-            if((head->partition_index >= (current_chunk * PRINT_FE_CHUNKS)) &&
-               (head->partition_index < ((current_chunk + 1) * PRINT_FE_CHUNKS))) {
-                size_t to_write = strlen(head->path);
-                if((write(fd[head->partition_index % PRINT_FE_CHUNKS], head->path, to_write) != (ssize_t)to_write) ||
-                    (write(fd[head->partition_index % PRINT_FE_CHUNKS], ln_term, 1) != 1)) {
-                    fprintf(stderr, "%s\n", strerror(errno));
-                    /* close all open descriptors */
-                    pnum_t i;
-                    for(i = 0; (i < PRINT_FE_CHUNKS) && (((current_chunk * PRINT_FE_CHUNKS) + i) < num_parts); i++)
-                        close(fd[i]);
-                    return (1);
-                }
+        free(out_filename);
+
+        for(; first_entry < ends[partition_index]; first_entry++) {
+            if(((path = get_file_entry_path(store, order[first_entry], &buf,
+                &path_len)) == NULL) ||
+                (output_buffer_write(&out, fd, path, path_len,
+                *ln_term) != 0)) {
+                fprintf(stderr, "%s\n", strerror(errno));
+                close(fd);
+                retval = 1;
+                goto cleanup;
             }
-            head = head->nextp;
         }
-        /* come back to first entry */
-        head = start;
-
-        /* close file descriptors */
-        pnum_t i;
-        for(i = 0; (i < PRINT_FE_CHUNKS) && (((current_chunk * PRINT_FE_CHUNKS) + i) < num_parts); i++)
-            close(fd[i]);
-
-        current_file_entry = 0;
-        current_chunk++;
+        if(flush_output_buffer(&out, fd) != 0) {
+            fprintf(stderr, "%s\n", strerror(errno));
+            close(fd);
+            retval = 1;
+            goto cleanup;
+        }
+        close(fd);
     }
 
-    return (0);
+cleanup:
+    if(order != NULL)
+        free(order);
+    free(ends);
+    uninit_output_buffer(&out);
+    uninit_path_buffer(&buf);
+    return (retval);
 }
 
-/***************************************************
- Array of file_entry pointers manipulation functions
- ***************************************************/
+/**************************************************
+ Array of file_entry keys manipulation functions
+ **************************************************/
 
-/* Initialize an array of file_entry pointers from a double-linked
-   list of file_entries (head) */
+/* Initialize an array of file_entry keys from a store
+   - keys must be able to hold store->num_entries elements */
 void
-init_file_entry_p(struct file_entry **file_entry_p, fnum_t num_entries,
-    struct file_entry *head)
+init_file_entry_keys(struct file_entry_key *keys,
+    struct file_entry_store *store)
 {
-    assert(file_entry_p != NULL);
+    assert(keys != NULL);
+    assert(store != NULL);
 
-    fnum_t i = 0;
-    while((head != NULL) && (file_entry_p != NULL) && (i < num_entries)) {
-        file_entry_p[i] = head;
-        head = head->nextp;
-        i++;
+    fnum_t i;
+    for(i = 0; i < store->num_entries; i++) {
+        keys[i].size = store->sizes[i];
+        keys[i].index = i;
     }
     return;
 }
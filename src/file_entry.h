@@ -32,38 +32,135 @@
 
 #include <sys/types.h>
 
-#if !defined(PRINT_FE_CHUNKS)
-#define PRINT_FE_CHUNKS 32          /* files per chunk when flushing
-                                       partitions to disk */
+#if !defined(FILE_ENTRY_STORE_MIN_ENTRIES)
+#define FILE_ENTRY_STORE_MIN_ENTRIES 64 /* entries allocated at first add */
 #endif
 
-/* A file entry */
-struct file_entry;
-struct file_entry {
-    char *path;                     /* file name */
-    fsize_t size;                   /* size in bytes */
-    pnum_t partition_index;         /* assigned partition index */
+#if !defined(FILE_ENTRY_STORE_MIN_DIRS)
+#define FILE_ENTRY_STORE_MIN_DIRS 16 /* directories allocated at first add */
+#endif
+
+#if !defined(OUTPUT_BUFFER_SIZE)
+#define OUTPUT_BUFFER_SIZE 131072   /* size of partition files' output
+                                       buffer */
+#endif
+
+#if !defined(PATH_ARENA_MIN_SIZE)
+#define PATH_ARENA_MIN_SIZE 4096    /* size of first path arena chunk */
+#endif
+#if !defined(PATH_ARENA_MAX_SIZE)
+#define PATH_ARENA_MAX_SIZE 1048576 /* maximum size of path arena chunks
+                                       (unless a path does not fit) */
+#endif
 
-    struct file_entry* nextp;       /* next file_entry */
-    struct file_entry* prevp;       /* previous one */
+/* A chunk of path storage (bump allocator) */
+struct path_arena;
+struct path_arena {
+    char *data;                     /* path storage */
+    size_t size;                    /* allocated size */
+    size_t used;                    /* used size */
+
+    struct path_arena* prevp;       /* previous chunk */
+};
+
+/* No directory node (entry or directory path does not contain any '/') */
+#define FILE_ENTRY_NO_DIR   ((fnum_t)-1)
+
+/* A store of file entries (struct of arrays, indexed by entry number)
+   - paths are split at their last '/' into a parent directory node and
+     a leaf name ; directory nodes are interned the same way, recursively,
+     so that directory components are stored once */
+struct file_entry_store {
+    fnum_t *dirs;                   /* parent directory nodes */
+    char **names;                   /* leaf names (within arenas) */
+    fsize_t *sizes;                 /* sizes in bytes */
+    pnum_t *partition_indexes;      /* assigned partition indexes */
+    fnum_t num_entries;             /* number of entries */
+    fnum_t alloc_entries;           /* number of allocated entries */
+
+    fnum_t *dir_parents;            /* parent node of each directory node */
+    char **dir_names;               /* directory names (within arenas) */
+    fnum_t num_dirs;                /* number of directory nodes */
+    fnum_t alloc_dirs;              /* number of allocated directory nodes */
+    fnum_t *dir_buckets;            /* hash table of directory nodes */
+    fnum_t num_dir_buckets;         /* number of buckets (a power of 2) */
+    char *last_dir_path;            /* last directory path interned */
+    size_t last_dir_len;            /* its length */
+    size_t last_dir_size;           /* allocated size */
+    fnum_t last_dir;                /* its directory node */
+
+    struct path_arena *arena;       /* last path arena chunk */
+    size_t arena_size;              /* total size of path arena chunks */
+
+    void *map;                      /* snapshot mapping dirs, sizes and
+                                       dir_parents point to (option -I),
+                                       read-only store if not NULL */
+    size_t map_size;                /* size of mapping */
+};
+
+/* A buffer used to rebuild paths from a store */
+struct path_buffer {
+    char *data;                     /* path */
+    size_t size;                    /* allocated size */
+    fnum_t dir;                     /* directory node currently in data */
+    size_t dir_len;                 /* length of its path, including '/' */
+};
+
+/* A buffer used to coalesce writes to a partition file */
+struct output_buffer {
+    char *data;                     /* pending data */
+    size_t len;                     /* length of pending data */
+    size_t size;                    /* allocated size (0 if unbuffered) */
+};
+
+/* An asynchronous hook or job (options -H and -C) */
+struct live_hook {
+    pid_t pid;                      /* hook's process ID */
+    const char *cmd;                /* hook's command (or job's template) */
+    char *job_cmd;                  /* job's expanded command, NULL for
+                                       hooks */
+    pnum_t partition_index;         /* partition the hook was started for */
+};
+
+/* A (size, index) pair referring to an entry within a store,
+   used for sorting */
+struct file_entry_key {
+    fsize_t size;                   /* size in bytes */
+    fnum_t index;                   /* entry index */
 };
 
 int fpart_hook(const char *cmd, const struct program_options *options,
     const char *live_filename, const pnum_t *live_partition_index,
     const fsize_t *live_partition_size, const fnum_t *live_num_files);
-int handle_file_entry(struct file_entry **head, char *path, fsize_t size,
-    struct program_options *options);
-int live_print_file_entry(char *path, fsize_t size,
-    struct program_options *options);
-int add_file_entry(struct file_entry **head, char *path, fsize_t size,
+void init_file_entry_store(struct file_entry_store *store);
+void uninit_file_entry_store(struct file_entry_store *store);
+int push_file_entry(struct file_entry_store *store, const char *path,
+    fsize_t size);
+int append_file_entry_store(struct file_entry_store *dst,
+    struct file_entry_store *src);
+size_t get_file_entry_store_size(struct file_entry_store *store);
+int trim_file_entry_store(struct file_entry_store *store, pnum_t first_part);
+void init_path_buffer(struct path_buffer *buf);
+void uninit_path_buffer(struct path_buffer *buf);
+const char *get_file_entry_path(struct file_entry_store *store, fnum_t index,
+    struct path_buffer *buf, size_t *len);
+int handle_file_entry(struct file_entry_store *store, char *path,
+    fsize_t size, struct program_options *options);
+int live_print_file_entry(const char *path, fsize_t size,
     struct program_options *options);
-int init_file_entries(char *file_path, struct file_entry **head, fnum_t *count,
+int add_file_entry(struct file_entry_store *store, char *path, fsize_t size,
     struct program_options *options);
-void uninit_file_entries(struct file_entry *head,
+int init_file_entries(char *file_path, struct file_entry_store *store,
+    fnum_t *count, struct program_options *options);
+struct crawl_task;
+int walk_file_entries(char *file_path, struct crawl_task *task,
+    struct file_entry_store *store, fnum_t *count,
     struct program_options *options);
-int print_file_entries(struct file_entry *head, pnum_t num_parts,
+void uninit_file_entries(struct file_entry_store *store,
     struct program_options *options);
-void init_file_entry_p(struct file_entry **file_entry_p, fnum_t num_entries,
-    struct file_entry *head);
+int print_file_entries(struct file_entry_store *store, pnum_t first_part,
+    pnum_t num_parts, int append, struct program_options *options);
+void init_file_entry_keys(struct file_entry_key *keys,
+    struct file_entry_store *store);
 
 #endif /* _FILE_ENTRY_H */
@@ -31,11 +31,17 @@
 #include "partition.h"
 #include "file_entry.h"
 #include "dispatch.h"
+#include "crawl.h"
+#include "checkpoint.h"
+#include "cache.h"
+#include "snapshot.h"
+#include "extsort.h"
+#include "input.h"
 
 /* NULL, exit(3) */
 #include <stdlib.h>
 
-/* fprintf(3), fopen(3), fclose(3), fgets(3), foef(3) */
+/* fprintf(3) */
 #include <stdio.h>
 
 /* getopt(3) */
@@ -47,12 +53,6 @@
 /* strlen(3) */
 #include <string.h>
 
-/* bzero(3) */
-#include <strings.h>
-
-/* errno */
-#include <errno.h>
-
 /* assert(3) */
 #include <assert.h>
 
@@ -93,18 +93,30 @@ usage(void)
     fprintf(stderr, "  -n\tpack files into <num> partitions\n");
     fprintf(stderr, "  -f\tlimit partitions to <files> files or directories\n");
     fprintf(stderr, "  -s\tlimit partitions to <size> bytes\n");
+    fprintf(stderr, "  -k\twrite and free closed partitions every <num> files "
+        "(with -f or -s)\n");
+    fprintf(stderr, "  -M\tlimit memory used to sort files to <size> bytes, "
+        "using temporary files\n\t(with -n)\n");
     fprintf(stderr, "\n");
     fprintf(stderr, "Input control:\n");
     fprintf(stderr, "  -i\tread file list from <infile> "
-        "(stdin if '-' is specified)\n");
+        "(stdin if '-' is specified,\n\tmay be specified more than once)\n");
     fprintf(stderr, "  -a\tinput contains arbitrary values "
         "(do not crawl filesystem)\n");
+    fprintf(stderr, "  -Z\tinput filenames end with a null (\\0) "
+        "character\n");
+    fprintf(stderr, "  -F\tread arbitrary values using <format> : text "
+        "(default),\n\ttsv[:size,path], csv[:size,path] or bin:recordsize\n");
+    fprintf(stderr, "  -I\tload file entries from <snapshot> "
+        "(do not crawl filesystem)\n");
     fprintf(stderr, "\n");
     fprintf(stderr, "Output control:\n");
     fprintf(stderr, "  -o\toutput partitions to <outfile> template "
         "(stdout if '-' is specified)\n");
+    fprintf(stderr, "  -O\tsave file entries to <snapshot> (to be loaded "
+        "with -I)\n");
     fprintf(stderr, "  -0\tend filenames with a null (\\0) character when "
-        "using option -o\n");
+        "using option -o\n\t(or -S)\n");
     fprintf(stderr, "  -e\tadd ending slash to directories\n");
     fprintf(stderr, "  -v\tverbose mode (may be specified more than once to "
         "increase verbosity)\n");
@@ -121,6 +133,14 @@ usage(void)
         "more than once)\n");
 #if defined(_HAS_FNM_CASEFOLD)
     fprintf(stderr, "  -X\tsame as -x, but ignore case\n");
+#endif
+    fprintf(stderr, "  -j\tcrawl filesystem (and sort files with -n) using "
+        "<num> threads\n");
+    fprintf(stderr, "  -J\tkeep crawling order when using option -j "
+        "(live mode)\n");
+#if defined(EMBED_FTS)
+    fprintf(stderr, "  -c\tre-use listings of unchanged directories from "
+        "<cachefile>, and update it\n");
 #endif
     fprintf(stderr, "\n");
     fprintf(stderr, "Directory handling:\n");
@@ -141,6 +161,14 @@ usage(void)
         "start\n");
     fprintf(stderr, "  -W\tpost-partition hook: execute <cmd> at partition "
         "end\n");
+    fprintf(stderr, "  -P\thook co-process: execute <cmd> once and write "
+        "partition events\n\tto its standard input (instead of -w and -W)\n");
+    fprintf(stderr, "  -C\tjob: execute <cmd> for each finished partition "
+        "(%%f: partition file)\n");
+    fprintf(stderr, "  -S\tstream each partition to the standard input of "
+        "a new <cmd>\n\t(instead of -o)\n");
+    fprintf(stderr, "  -H\trun up to <num> hooks, jobs or consumers "
+        "asynchronously\n\t(do not wait for them)\n");
     fprintf(stderr, "\n");
     fprintf(stderr, "Size handling:\n");
     fprintf(stderr, "  -p\tpreload each partition with <num> bytes\n");
@@ -155,82 +183,6 @@ usage(void)
     return;
 }
 
-/* Handle one argument (either a path to crawl or an arbitrary
-   value) and update file entries (head)
-   - returns != 0 if a critical error occurred
-   - returns with head set to the last element added
-   - updates totalfiles with the number of elements added */
-static int
-handle_argument(char *argument, fnum_t *totalfiles, struct file_entry **head,
-    struct program_options *options)
-{
-    assert(argument != NULL);
-    assert(totalfiles != NULL);
-    assert(head != NULL);
-    assert(options != NULL);
-
-    if(options->arbitrary_values == OPT_ARBITRARYVALUES) {
-    /* handle arbitrary values */
-        fsize_t input_size = 0;
-        char *input_path = NULL;
-        if_not_malloc(input_path, strlen(argument) + 1,
-            return (1);
-        )
-
-        if(sscanf(argument, "%lld %[^\n]", &input_size, input_path) == 2) {
-            if(handle_file_entry(head, input_path, input_size, options) == 0)
-                (*totalfiles)++;
-            else {
-                fprintf(stderr, "%s(): cannot add file entry\n", __func__);
-                free(input_path);
-                return (1);
-            }
-        }
-        else
-            fprintf(stderr, "error parsing input values: %s\n", argument);
-
-        /* cleanup */
-        free(input_path);
-    }
-    else {
-    /* handle paths, must examine filesystem */
-        char *input_path = NULL;
-        size_t input_path_len = strlen(argument);
-        size_t malloc_size = input_path_len + 1;
-        if_not_malloc(input_path, malloc_size,
-            return (1);
-        )
-        snprintf(input_path, malloc_size, "%s", argument);
-    
-        /* remove multiple ending slashes */
-        while((input_path_len > 1) &&
-            (input_path[input_path_len - 1] == '/')  &&
-            (input_path[input_path_len - 2] == '/')) {
-            input_path[input_path_len - 1] = '\0';
-            input_path_len--;
-        }
-
-        /* crawl path */
-        if(input_path[0] != '\0') {
-#if defined(DEBUG)
-            fprintf(stderr, "init_file_entries(): examining %s\n",
-                input_path);
-#endif
-            if(init_file_entries(input_path, head, totalfiles, options) != 0) {
-                fprintf(stderr, "%s(): cannot initialize file entries\n",
-                    __func__);
-                free(input_path);
-                return (1);
-            }
-        }
-
-        /* cleanup */
-        free(input_path);
-    }
-
-    return (0);
-}
-
 /* Handle options parsing
    - initializes options structure using argc and argv (through pointers)
    - returns a value defined by the mask below */
@@ -256,9 +208,9 @@ handle_options(struct program_options *options, int *argcp, char ***argvp)
     int ch;
     while((ch = getopt(*argcp, *argvp,
 #if defined(_HAS_FNM_CASEFOLD)
-        "?hVn:f:s:i:ao:0evlby:Y:x:X:zd:DELw:W:p:q:r:"
+        "?hVn:f:s:k:M:i:aZF:I:o:O:0evlby:Y:x:X:j:Jc:zd:DELw:W:P:C:S:H:p:q:r:"
 #else
-        "?hVn:f:s:i:ao:0evlby:x:zd:DELw:W:p:q:r:"
+        "?hVn:f:s:k:M:i:aZF:I:o:O:0evlby:x:j:Jc:zd:DELw:W:P:C:S:H:p:q:r:"
 #endif
         )) != -1) {
         switch(ch) {
@@ -301,20 +253,54 @@ handle_options(struct program_options *options, int *argcp, char ***argvp)
                 options->max_size = (fsize_t)max_size;
                 break;
             }
+            case 'k':
+            {
+                char *endptr = NULL;
+                long long checkpoint = strtoll(optarg, &endptr, 10);
+                /* refuse values <= 0 and partially-converted arguments */
+                if((endptr == optarg) || (*endptr != '\0') ||
+                    (checkpoint <= 0)) {
+                    fprintf(stderr,
+                        "Option -k requires a value greater than 0.\n");
+                    return (FPART_OPTS_USAGE |
+                        FPART_OPTS_NOK | FPART_OPTS_EXIT);
+                }
+                options->checkpoint = (fnum_t)checkpoint;
+                break;
+            }
+            case 'M':
+            {
+                char *endptr = NULL;
+                long long mem_limit = strtoll(optarg, &endptr, 10);
+                /* refuse values <= 0 and partially-converted arguments */
+                if((endptr == optarg) || (*endptr != '\0') ||
+                    (mem_limit <= 0)) {
+                    fprintf(stderr,
+                        "Option -M requires a value greater than 0.\n");
+                    return (FPART_OPTS_USAGE |
+                        FPART_OPTS_NOK | FPART_OPTS_EXIT);
+                }
+                options->mem_limit = (fsize_t)mem_limit;
+                break;
+            }
             case 'i':
             {
                 /* check for empty argument */
                 if(strlen(optarg) == 0)
                     break;
-                /* replace previous filename if '-i' specified multiple times */
-                if(options->in_filename != NULL)
-                    free(options->in_filename);
-                options->in_filename = abs_path(optarg);
-                if(options->in_filename == NULL) {
+                /* '-i' may be specified multiple times */
+                char *in_filename = abs_path(optarg);
+                if(in_filename == NULL) {
                     fprintf(stderr, "%s(): cannot determine absolute path for "
                         "file '%s'\n", __func__, optarg);
                     return (FPART_OPTS_NOK | FPART_OPTS_EXIT);
                 }
+                if(str_push(&options->in_filenames, &options->nin_filenames,
+                    in_filename) != 0) {
+                    free(in_filename);
+                    return (FPART_OPTS_NOK | FPART_OPTS_EXIT);
+                }
+                free(in_filename);
                 break;
             }
             case 'a':
@@ -341,6 +327,37 @@ handle_options(struct program_options *options, int *argcp, char ***argvp)
                 }
                 break;
             }
+            case 'O':
+            case 'I':
+            {
+                char **snapshot = (ch == 'O') ?
+                    &options->snapshot_out : &options->snapshot_in;
+                /* check for empty argument */
+                if(strlen(optarg) == 0)
+                    break;
+                /* replace previous filename if specified multiple times */
+                if(*snapshot != NULL)
+                    free(*snapshot);
+                *snapshot = abs_path(optarg);
+                if(*snapshot == NULL) {
+                    fprintf(stderr, "%s(): cannot determine absolute path for "
+                        "file '%s'\n", __func__, optarg);
+                    return (FPART_OPTS_NOK | FPART_OPTS_EXIT);
+                }
+                break;
+            }
+            case 'Z':
+                options->in_zero = OPT_IN0;
+                break;
+            case 'F':
+            {
+                if(set_input_format(optarg, options) != 0) {
+                    fprintf(stderr, "Option -F requires a valid format.\n");
+                    return (FPART_OPTS_USAGE |
+                        FPART_OPTS_NOK | FPART_OPTS_EXIT);
+                }
+                break;
+            }
             case '0':
                 options->out_zero = OPT_OUT0;
                 break;
@@ -389,6 +406,47 @@ handle_options(struct program_options *options, int *argcp, char ***argvp)
                     return (FPART_OPTS_NOK | FPART_OPTS_EXIT);
                 break;
             }
+            case 'j':
+            {
+                char *endptr = NULL;
+                long num_jobs = strtol(optarg, &endptr, 10);
+                /* refuse values <= 0 and partially-converted arguments */
+                if((endptr == optarg) || (*endptr != '\0') ||
+                    (num_jobs <= 0)) {
+                    fprintf(stderr,
+                        "Option -j requires a value greater than 0.\n");
+                    return (FPART_OPTS_USAGE |
+                        FPART_OPTS_NOK | FPART_OPTS_EXIT);
+                }
+                options->num_jobs = (unsigned int)num_jobs;
+                break;
+            }
+            case 'J':
+                options->keep_order = OPT_KEEPORDER;
+                break;
+            case 'c':
+            {
+                /* check for empty argument */
+                if(strlen(optarg) == 0)
+                    break;
+#if !defined(EMBED_FTS)
+                fprintf(stderr,
+                    "Option -c requires fpart to be built with embedded "
+                    "fts(3).\n");
+                return (FPART_OPTS_NOK | FPART_OPTS_EXIT);
+#else
+                /* replace previous filename if '-c' specified multiple times */
+                if(options->cache_filename != NULL)
+                    free(options->cache_filename);
+                options->cache_filename = abs_path(optarg);
+                if(options->cache_filename == NULL) {
+                    fprintf(stderr, "%s(): cannot determine absolute path for "
+                        "file '%s'\n", __func__, optarg);
+                    return (FPART_OPTS_NOK | FPART_OPTS_EXIT);
+                }
+                break;
+#endif
+            }
             case 'z':
                 options->dirs_include++;
                 break;
@@ -443,6 +501,68 @@ handle_options(struct program_options *options, int *argcp, char ***argvp)
                 snprintf(options->post_part_hook, malloc_size, "%s", optarg);
                 break;
             }
+            case 'P':
+            {
+                /* check for empty argument */
+                size_t malloc_size = strlen(optarg) + 1;
+                if(malloc_size <= 1)
+                    break;
+                /* replace previous co-process if '-P' specified multiple
+                   times */
+                if(options->hook_coproc != NULL)
+                    free(options->hook_coproc);
+                if_not_malloc(options->hook_coproc, malloc_size,
+                    return (FPART_OPTS_NOK | FPART_OPTS_EXIT);
+                )
+                snprintf(options->hook_coproc, malloc_size, "%s", optarg);
+                break;
+            }
+            case 'C':
+            {
+                /* check for empty argument */
+                size_t malloc_size = strlen(optarg) + 1;
+                if(malloc_size <= 1)
+                    break;
+                /* replace previous job if '-C' specified multiple times */
+                if(options->job_cmd != NULL)
+                    free(options->job_cmd);
+                if_not_malloc(options->job_cmd, malloc_size,
+                    return (FPART_OPTS_NOK | FPART_OPTS_EXIT);
+                )
+                snprintf(options->job_cmd, malloc_size, "%s", optarg);
+                break;
+            }
+            case 'S':
+            {
+                /* check for empty argument */
+                size_t malloc_size = strlen(optarg) + 1;
+                if(malloc_size <= 1)
+                    break;
+                /* replace previous consumer if '-S' specified multiple
+                   times */
+                if(options->stream_cmd != NULL)
+                    free(options->stream_cmd);
+                if_not_malloc(options->stream_cmd, malloc_size,
+                    return (FPART_OPTS_NOK | FPART_OPTS_EXIT);
+                )
+                snprintf(options->stream_cmd, malloc_size, "%s", optarg);
+                break;
+            }
+            case 'H':
+            {
+                char *endptr = NULL;
+                long hook_jobs = strtol(optarg, &endptr, 10);
+                /* refuse values <= 0 and partially-converted arguments */
+                if((endptr == optarg) || (*endptr != '\0') ||
+                    (hook_jobs <= 0)) {
+                    fprintf(stderr,
+                        "Option -H requires a value greater than 0.\n");
+                    return (FPART_OPTS_USAGE |
+                        FPART_OPTS_NOK | FPART_OPTS_EXIT);
+                }
+                options->hook_jobs = (unsigned int)hook_jobs;
+                break;
+            }
             case 'p':
             {
                 char *endptr = NULL;
@@ -510,7 +630,23 @@ handle_options(struct program_options *options, int *argcp, char ***argvp)
         return (FPART_OPTS_USAGE | FPART_OPTS_NOK | FPART_OPTS_EXIT);
     }
 
-    if(options->arbitrary_values == OPT_ARBITRARYVALUES) {
+    if((options->checkpoint != DFLT_OPT_CHECKPOINT) &&
+        ((options->num_parts != DFLT_OPT_NUM_PARTS) ||
+        (options->live_mode != DFLT_OPT_LIVEMODE))) {
+        fprintf(stderr,
+            "Option -k is incompatible with options -n and -L.\n");
+        return (FPART_OPTS_USAGE | FPART_OPTS_NOK | FPART_OPTS_EXIT);
+    }
+
+    if((options->mem_limit != DFLT_OPT_MEM_LIMIT) &&
+        (options->num_parts == DFLT_OPT_NUM_PARTS)) {
+        fprintf(stderr,
+            "Option -M can only be used with option -n.\n");
+        return (FPART_OPTS_USAGE | FPART_OPTS_NOK | FPART_OPTS_EXIT);
+    }
+
+    if((options->arbitrary_values == OPT_ARBITRARYVALUES) ||
+        (options->snapshot_in != NULL)) {
         if((options->add_slash != DFLT_OPT_ADDSLASH) ||
             (options->follow_symbolic_links != DFLT_OPT_FOLLOWSYMLINKS) ||
             (options->cross_fs_boundaries != DFLT_OPT_CROSSFSBOUNDARIES) ||
@@ -518,20 +654,77 @@ handle_options(struct program_options *options, int *argcp, char ***argvp)
             (options->include_files_ci != NULL) ||
             (options->exclude_files != NULL) ||
             (options->exclude_files_ci != NULL) ||
+            ((options->keep_order != DFLT_OPT_KEEPORDER) &&
+            (options->snapshot_in != NULL)) ||
+            (options->cache_filename != NULL) ||
             (options->dirs_include != DFLT_OPT_DIRSINCLUDE) ||
             (options->dir_depth != DFLT_OPT_DIR_DEPTH) ||
             (options->leaf_dirs != DFLT_OPT_LEAFDIRS) ||
             (options->dirs_only != DFLT_OPT_DIRSONLY)) {
             fprintf(stderr,
-                "Option -a is incompatible with crawling-related options.\n");
+                "Options -a and -I are incompatible with crawling-related "
+                "options.\n");
             return (FPART_OPTS_USAGE | FPART_OPTS_NOK | FPART_OPTS_EXIT);
         }
     }
 
+    if((options->snapshot_in != NULL) &&
+        ((options->nin_filenames > 0) || (*argcp > 0) ||
+        (options->arbitrary_values != DFLT_OPT_ARBITRARYVALUES) ||
+        (options->live_mode != DFLT_OPT_LIVEMODE) ||
+        (options->mem_limit != DFLT_OPT_MEM_LIMIT) ||
+        (options->overload_size != DFLT_OPT_OVERLOAD_SIZE) ||
+        (options->round_size != DFLT_OPT_ROUND_SIZE))) {
+        /* sizes are saved overloaded and rounded (options -q and -r) */
+        fprintf(stderr,
+            "Option -I is incompatible with options -i, -a, -L, -M, -q, -r "
+            "and file arguments.\n");
+        return (FPART_OPTS_USAGE | FPART_OPTS_NOK | FPART_OPTS_EXIT);
+    }
+
+    if((options->snapshot_out != NULL) &&
+        ((options->checkpoint != DFLT_OPT_CHECKPOINT) ||
+        (options->live_mode != DFLT_OPT_LIVEMODE) ||
+        (options->mem_limit != DFLT_OPT_MEM_LIMIT))) {
+        fprintf(stderr,
+            "Option -O is incompatible with options -k, -L and -M.\n");
+        return (FPART_OPTS_USAGE | FPART_OPTS_NOK | FPART_OPTS_EXIT);
+    }
+
+    if((options->in_format != DFLT_OPT_INFORMAT) &&
+        (options->arbitrary_values != OPT_ARBITRARYVALUES)) {
+        fprintf(stderr,
+            "Option -F is valid only when used with option -a.\n");
+        return (FPART_OPTS_USAGE | FPART_OPTS_NOK | FPART_OPTS_EXIT);
+    }
+
+    if((options->in_format == OPT_INFORMAT_BIN) &&
+        ((options->in_zero != DFLT_OPT_IN0) || (*argcp > 0))) {
+        fprintf(stderr,
+            "Option -F bin is incompatible with option -Z and file "
+            "arguments.\n");
+        return (FPART_OPTS_USAGE | FPART_OPTS_NOK | FPART_OPTS_EXIT);
+    }
+
+    if((options->in_zero == OPT_IN0) &&
+        ((options->snapshot_in != NULL) ||
+        ((options->nin_filenames == 0) && (*argcp > 0)))) {
+        fprintf(stderr,
+            "Option -Z is valid only when reading file list from input.\n");
+        return (FPART_OPTS_USAGE | FPART_OPTS_NOK | FPART_OPTS_EXIT);
+    }
+
     if((options->out_zero == OPT_OUT0) &&
-        options->out_filename == NULL) {
+        (options->out_filename == NULL) && (options->stream_cmd == NULL)) {
+        fprintf(stderr,
+            "Option -0 is valid only when used with option -o or -S.\n");
+        return (FPART_OPTS_USAGE | FPART_OPTS_NOK | FPART_OPTS_EXIT);
+    }
+
+    if((options->keep_order == OPT_KEEPORDER) &&
+        (options->num_jobs == DFLT_OPT_NUM_JOBS)) {
         fprintf(stderr,
-            "Option -0 is valid only when used with option -o.\n");
+            "Option -J is valid only when used with option -j.\n");
         return (FPART_OPTS_USAGE | FPART_OPTS_NOK | FPART_OPTS_EXIT);
     }
 
@@ -551,20 +744,56 @@ handle_options(struct program_options *options, int *argcp, char ***argvp)
 
     if((options->live_mode == OPT_NOLIVEMODE) &&
         ((options->pre_part_hook != NULL) ||
-        (options->post_part_hook != NULL))) {
+        (options->post_part_hook != NULL) ||
+        (options->hook_coproc != NULL))) {
         fprintf(stderr,
             "Hooks can only be used with option -L.\n");
         return (FPART_OPTS_USAGE | FPART_OPTS_NOK | FPART_OPTS_EXIT);
     }
 
-    if((options->in_filename == NULL) && (*argcp <= 0)) {
+    if((options->hook_coproc != NULL) &&
+        ((options->pre_part_hook != NULL) ||
+        (options->post_part_hook != NULL))) {
+        fprintf(stderr,
+            "Option -P is incompatible with options -w and -W.\n");
+        return (FPART_OPTS_USAGE | FPART_OPTS_NOK | FPART_OPTS_EXIT);
+    }
+
+    if((options->job_cmd != NULL) &&
+        ((options->live_mode == OPT_NOLIVEMODE) ||
+        (options->out_filename == NULL))) {
+        fprintf(stderr,
+            "Option -C is valid only when used with options -L and -o.\n");
+        return (FPART_OPTS_USAGE | FPART_OPTS_NOK | FPART_OPTS_EXIT);
+    }
+
+    if((options->stream_cmd != NULL) &&
+        ((options->live_mode == OPT_NOLIVEMODE) ||
+        (options->out_filename != NULL) ||
+        (options->job_cmd != NULL))) {
+        fprintf(stderr,
+            "Option -S is valid only when used with option -L, and is "
+            "incompatible\nwith options -o and -C.\n");
+        return (FPART_OPTS_USAGE | FPART_OPTS_NOK | FPART_OPTS_EXIT);
+    }
+
+    if((options->hook_jobs != DFLT_OPT_HOOK_JOBS) &&
+        (options->pre_part_hook == NULL) &&
+        (options->post_part_hook == NULL) &&
+        (options->job_cmd == NULL) &&
+        (options->stream_cmd == NULL)) {
+        fprintf(stderr,
+            "Option -H is valid only when used with option -w, -W, -C or "
+            "-S.\n");
+        return (FPART_OPTS_USAGE | FPART_OPTS_NOK | FPART_OPTS_EXIT);
+    }
+
+    if((options->nin_filenames == 0) && (*argcp <= 0) &&
+        (options->snapshot_in == NULL)) {
         /* no file specified, force stdin */
-        char *opt_input = "-";
-        size_t malloc_size = strlen(opt_input) + 1;
-        if_not_malloc(options->in_filename, malloc_size,
+        if(str_push(&options->in_filenames, &options->nin_filenames,
+            "-") != 0)
             return (FPART_OPTS_NOK | FPART_OPTS_EXIT);
-        )
-        snprintf(options->in_filename, malloc_size, "%s", opt_input);
     }
 
     return (FPART_OPTS_OK);
@@ -597,73 +826,117 @@ int main(int argc, char **argv)
             EXIT_FAILURE : EXIT_SUCCESS);
     }
 
+/*****************
+  Start crawlers
+ *****************/
+
+    if(crawl_init(&options) != 0) {
+        fprintf(stderr, "%s(): cannot start crawling threads\n", __func__);
+        uninit_options(&options);
+        exit(EXIT_FAILURE);
+    }
+
+    if(cache_init(&options) != 0) {
+        fprintf(stderr, "%s(): cannot initialize crawl cache\n", __func__);
+        crawl_uninit();
+        uninit_options(&options);
+        exit(EXIT_FAILURE);
+    }
+
 /**************
   Handle stdin
 ***************/
 
-    /* our main double-linked file list */
-    struct file_entry *head = NULL;
+    /* our main file entry store */
+    struct file_entry_store store;
+    init_file_entry_store(&store);
 
-    if(options.verbose >= OPT_VERBOSE)
-        fprintf(stderr, "Examining filesystem...\n");
+    /* load file entries from snapshot (option -I) */
+    if(options.snapshot_in != NULL) {
+        if(options.verbose >= OPT_VERBOSE)
+            fprintf(stderr, "Loading snapshot...\n");
 
-    /* work on each file provided through input file (or stdin) */
-    if(options.in_filename != NULL) {
-        /* handle fd opening */
-        FILE *in_fp = NULL;
-        if((options.in_filename[0] == '-') &&
-            (options.in_filename[1] == '\0')) {
-            /* working from stdin */
-            in_fp = stdin;
-        }
-        else {
-            /* working from a filename */
-            if((in_fp = fopen(options.in_filename, "r")) == NULL) {
-                fprintf(stderr, "%s: %s\n", options.in_filename,
-                    strerror(errno));
-                uninit_options(&options);
-                exit(EXIT_FAILURE);
-            }
+        if(load_file_entry_snapshot(&store, options.snapshot_in) != 0) {
+            crawl_uninit();
+            cache_uninit(0);
+            uninit_options(&options);
+            exit(EXIT_FAILURE);
         }
+        totalfiles = store.num_entries;
+    }
+    else if(options.verbose >= OPT_VERBOSE)
+        fprintf(stderr, "Examining filesystem...\n");
 
-        /* read fd and do the work */
-        char line[MAX_LINE_LENGTH];
-        char *line_end_p = NULL;
-        bzero(line, MAX_LINE_LENGTH);
-        while(fgets(line, MAX_LINE_LENGTH, in_fp) != NULL) {
-            /* replace '\n' with '\0' */
-            if ((line_end_p = strchr(line, '\n')) != NULL)
-                *line_end_p = '\0';
-
-            if(handle_argument(line, &totalfiles, &head, &options) != 0) {
-                uninit_file_entries(head, &options);
-                uninit_options(&options);
-                exit(EXIT_FAILURE);
-            }
+    /* work on each file provided through input files (or stdin), then on
+       each path provided as arguments ; when crawling threads are active,
+       input files and paths are queued as crawling tasks and their entries
+       collected in command-line order */
+    int retval = 0;
+    unsigned int i;
+    for(i = 0; (retval == 0) && (i < options.nin_filenames); i++) {
+        if(crawl_active())
+            retval = crawl_queue_root(options.in_filenames[i], 1, &store,
+                &totalfiles, &options);
+        else
+            retval = handle_input_file(options.in_filenames[i], NULL, &store,
+                &totalfiles, &options);
+    }
 
-            /* cleanup */
-            bzero(line, MAX_LINE_LENGTH);
-        }
+/******************
+  Handle arguments
+*******************/
 
-        /* check for error reading input */
-        if(ferror(in_fp) != 0) {
-            fprintf(stderr, "error reading from input stream\n"); 
+    int j;
+    for(j = 0; (retval == 0) && (j < argc); j++) {
+        if(crawl_active() &&
+            (options.arbitrary_values == OPT_NOARBITRARYVALUES))
+            retval = crawl_queue_root(argv[j], 0, &store, &totalfiles,
+                &options);
+        else {
+            /* arbitrary values are cheap, add them after queued input
+               files to keep ordering */
+            if(crawl_active() &&
+                (crawl_flush_roots(&store, &totalfiles, &options) != 0))
+                retval = 1;
+            else
+                retval = handle_input_argument(argv[j], NULL, &store,
+                    &totalfiles, &options);
         }
+    }
 
-        /* cleanup */
-        if(in_fp != NULL)
-            fclose(in_fp);
+    /* collect remaining crawling tasks */
+    if(crawl_active() &&
+        (crawl_flush_roots(&store, &totalfiles, &options) != 0))
+        retval = 1;
+
+    if(retval != 0) {
+        crawl_uninit();
+        cache_uninit(0);
+        uninit_checkpoint();
+        extsort_uninit();
+        uninit_file_entries(&store, &options);
+        uninit_options(&options);
+        exit(EXIT_FAILURE);
     }
 
-/******************
-  Handle arguments
-*******************/
+    /* crawling done, stop threads */
+    crawl_uninit();
+
+    /* save crawl cache, a failure only affects next runs */
+    if(cache_uninit(1) != 0)
+        fprintf(stderr, "%s(): cannot write crawl cache\n", __func__);
+
+/****************
+  Save snapshot
+*****************/
+
+    if(options.snapshot_out != NULL) {
+        if(options.verbose >= OPT_VERBOSE)
+            fprintf(stderr, "Saving snapshot...\n");
 
-    /* now, work on each path provided as arguments */
-    int i;
-    for(i = 0 ; i < argc ; i++) {
-        if(handle_argument(argv[i], &totalfiles, &head, &options) != 0) {
-            uninit_file_entries(head, &options);
+        if(save_file_entry_snapshot(&store, options.snapshot_out) != 0) {
+            fprintf(stderr, "%s(): cannot save snapshot\n", __func__);
+            uninit_file_entries(&store, &options);
             uninit_options(&options);
             exit(EXIT_FAILURE);
         }
@@ -673,12 +946,9 @@ int main(int argc, char **argv)
   Display status
 *****************/
 
-    /* come back to the first element */
-    rewind_list(head);
-
     /* no file found or live mode */
     if((totalfiles <= 0) || (options.live_mode == OPT_LIVEMODE)) {
-        uninit_file_entries(head, &options);
+        uninit_file_entries(&store, &options);
         /* display status */
         if(options.verbose >= OPT_VERBOSE)
             fprintf(stderr, "%lld file(s) found.\n", totalfiles);
@@ -686,6 +956,27 @@ int main(int argc, char **argv)
         exit(EXIT_SUCCESS);
     }
 
+/*****************************************
+  Flush remaining partitions (option -k)
+******************************************/
+
+    if(options.checkpoint != DFLT_OPT_CHECKPOINT) {
+        /* display status */
+        if(options.verbose >= OPT_VERBOSE) {
+            fprintf(stderr, "%lld file(s) found.\n", totalfiles);
+            fprintf(stderr, "Writing output lists...\n");
+        }
+
+        int retval = flush_checkpoint(&store, &options);
+        if(retval != 0)
+            fprintf(stderr, "%s(): unable to write file entries\n", __func__);
+
+        /* free stuff */
+        uninit_file_entries(&store, &options);
+        uninit_options(&options);
+        exit(retval == 0 ? EXIT_SUCCESS : EXIT_FAILURE);
+    }
+
     /* display status */
     if(options.verbose >= OPT_VERBOSE) {
         fprintf(stderr, "%lld file(s) found.\n", totalfiles);
@@ -700,23 +991,54 @@ int main(int argc, char **argv)
     struct partition *part_head = NULL;
     pnum_t num_parts = options.num_parts;
 
+    /* sort files with a fixed size of partitions, entries having been spilled
+       to temporary files (option -M) */
+    if(extsort_active()) {
+        /* create a double_linked list of partitions
+           which will hold dispatched files */
+        if(add_partitions(&part_head, options.num_parts, &options) != 0) {
+            fprintf(stderr, "%s(): cannot init list of partitions\n",
+                __func__);
+            uninit_partitions(part_head);
+            extsort_uninit();
+            uninit_file_entries(&store, &options);
+            uninit_options(&options);
+            exit(EXIT_FAILURE);
+        }
+        /* come back to the first element */
+        rewind_list(part_head);
+
+        /* merge sorted runs and dispatch files */
+        if(extsort_dispatch(&store, totalfiles, part_head, options.num_parts,
+            &options) != 0) {
+            fprintf(stderr, "%s(): unable to dispatch file entries\n",
+                __func__);
+            uninit_partitions(part_head);
+            extsort_uninit();
+            uninit_file_entries(&store, &options);
+            uninit_options(&options);
+            exit(EXIT_FAILURE);
+        }
+    }
+
     /* sort files with a fixed size of partitions */
-    if(options.num_parts != DFLT_OPT_NUM_PARTS) {
-        /* create a fixed-size array of pointers to sort */
-        struct file_entry **file_entry_p = NULL;
+    else if(options.num_parts != DFLT_OPT_NUM_PARTS) {
+        /* create a fixed-size array of (size, index) keys to sort */
+        struct file_entry_key *file_entry_keys = NULL;
 
-        if_not_malloc(file_entry_p, sizeof(struct file_entry *) * totalfiles,
-            uninit_file_entries(head, &options);
+        if_not_malloc(file_entry_keys,
+            sizeof(struct file_entry_key) * totalfiles,
+            uninit_file_entries(&store, &options);
             uninit_options(&options);
             exit(EXIT_FAILURE);
         )
 
         /* initialize array */
-        init_file_entry_p(file_entry_p, totalfiles, head);
+        init_file_entry_keys(file_entry_keys, &store);
     
         /* sort array */
-        qsort(&file_entry_p[0], totalfiles, sizeof(struct file_entry *),
-            &sort_file_entry_p);
+        radix_sort_file_entry_keys(file_entry_keys, totalfiles,
+            options.num_jobs);
     
         /* create a double_linked list of partitions
            which will hold dispatched files */
@@ -724,8 +1046,8 @@ int main(int argc, char **argv)
             fprintf(stderr, "%s(): cannot init list of partitions\n",
                 __func__);
             uninit_partitions(part_head);
-            free(file_entry_p);
-            uninit_file_entries(head, &options);
+            free(file_entry_keys);
+            uninit_file_entries(&store, &options);
             uninit_options(&options);
             exit(EXIT_FAILURE);
         }
@@ -733,31 +1055,31 @@ int main(int argc, char **argv)
         rewind_list(part_head);
     
         /* dispatch files */
-        if(dispatch_file_entry_p_by_size
-            (file_entry_p, totalfiles, part_head, options.num_parts) != 0) {
+        if(dispatch_file_entry_keys_by_size(file_entry_keys, totalfiles,
+            &store, part_head, options.num_parts) != 0) {
             fprintf(stderr, "%s(): unable to dispatch file entries\n",
                 __func__);
             uninit_partitions(part_head);
-            free(file_entry_p);
-            uninit_file_entries(head, &options);
+            free(file_entry_keys);
+            uninit_file_entries(&store, &options);
             uninit_options(&options);
             exit(EXIT_FAILURE);
         }
     
         /* re-dispatch empty files */
         if(dispatch_empty_file_entries
-            (head, totalfiles, part_head, options.num_parts) != 0) {
+            (&store, totalfiles, part_head, options.num_parts) != 0) {
             fprintf(stderr, "%s(): unable to dispatch empty file entries\n",
                 __func__);
             uninit_partitions(part_head);
-            free(file_entry_p);
-            uninit_file_entries(head, &options);
+            free(file_entry_keys);
+            uninit_file_entries(&store, &options);
             uninit_options(&options);
             exit(EXIT_FAILURE);
         }
 
         /* cleanup */
-        free(file_entry_p);
+        free(file_entry_keys);
     }
 
 /***************************************************
@@ -768,12 +1090,12 @@ int main(int argc, char **argv)
        In this case, partitions are dynamically-created */
     else {
         if((num_parts = dispatch_file_entries_by_limits
-            (head, &part_head, options.max_entries, options.max_size,
+            (&store, &part_head, options.max_entries, options.max_size,
             &options)) == 0) {
             fprintf(stderr, "%s(): unable to dispatch file entries\n",
                 __func__);
             uninit_partitions(part_head);
-            uninit_file_entries(head, &options);
+            uninit_file_entries(&store, &options);
             uninit_options(&options);
             exit(EXIT_FAILURE);
         }
@@ -794,14 +1116,18 @@ int main(int argc, char **argv)
         fprintf(stderr, "Writing output lists...\n");
 
     /* print file entries */
-    print_file_entries(head, num_parts, &options);
+    if(extsort_active())
+        extsort_print_file_entries(&store, num_parts, &options);
+    else
+        print_file_entries(&store, 0, num_parts, 0, &options);
 
     if(options.verbose >= OPT_VERBOSE)
         fprintf(stderr, "Cleaning up...\n");
 
     /* free stuff */
     uninit_partitions(part_head);
-    uninit_file_entries(head, &options);
+    extsort_uninit();
+    uninit_file_entries(&store, &options);
     uninit_options(&options);
     exit(EXIT_SUCCESS);
 }
@@ -29,7 +29,4 @@
 
 #define FPART_VERSION "1.2.0"
 
-/* maximum input line length, including '\n' and '\0' */
-#define MAX_LINE_LENGTH 2048
-
 #endif /* _FPART_H */
@@ -35,6 +35,16 @@
  * GNU/Linux notes :
  *   - the FTS_NOSTAT speedup trick is disabled
  *   - no support for FTS_WHITEOUT (sparse files)
+ *   - statx(2) is used when available, only requesting the fields fts needs
+ *     (type, mode, size, inode, link count, times) and allowing cached
+ *     attributes to be used on network file systems (AT_STATX_DONT_SYNC)
+ *   - entries readdir(3) tells are neither directories nor regular files (nor
+ *     symbolic links to follow) are not stat()ed, only their mode is filled in
+ *   - entries of large directories are stat()ed asynchronously, in batches,
+ *     through io_uring(7) when available (see fts_uring_stat())
+ * fpart notes :
+ *   - directory listings may be read from and recorded to a cache, see
+ *     fts_set_cache()
  *
  */
 
@@ -67,6 +77,7 @@ __FBSDID("$FreeBSD: head/lib/libc/gen/fts.c 318913 2017-05-26 01:14:58Z pfg $");
 #if defined(__linux__)
 #include <sys/vfs.h>
 #include <sys/types.h>
+#include <sys/sysmacros.h>
 #include <fcntl.h>
 #endif
 #endif
@@ -89,6 +100,18 @@ __FBSDID("$FreeBSD: head/lib/libc/gen/fts.c 318913 2017-05-26 01:14:58Z pfg $");
 #endif
 #endif
 
+#if defined(__linux__) && defined(HAVE_LINUX_IO_URING_H)
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <stdint.h>
+/* IORING_OP_STATX is an enum value, it came along IORING_FEAT_RW_CUR_POS. */
+#if defined(IORING_FEAT_RW_CUR_POS) && defined(STATX_TYPE) && \
+    defined(__NR_io_uring_setup) && defined(__NR_io_uring_enter)
+#define	FTS_URING
+#endif
+#endif
+
 #include <dirent.h>
 #include <errno.h>
 #include <fcntl.h>
@@ -123,6 +146,7 @@ reallocf(void *ptr, size_t size)
 
 static FTSENT	*fts_alloc(FTS *, char *, size_t);
 static FTSENT	*fts_build(FTS *, int);
+static int	 fts_build_cached(FTS *, FTSENT **);
 static void	 fts_lfree(FTSENT *);
 static void	 fts_load(FTS *, FTSENT *);
 static size_t	 fts_maxarglen(char * const *);
@@ -130,10 +154,20 @@ static void	 fts_padjust(FTS *, FTSENT *);
 static int	 fts_palloc(FTS *, size_t);
 static FTSENT	*fts_sort(FTS *, FTSENT *, size_t);
 static int	 fts_stat(FTS *, FTSENT *, int, int);
+static int	 fts_stat_info(FTSENT *, struct stat *);
 static int	 fts_safe_changedir(FTS *, FTSENT *, int, char *);
 #if !defined(__linux__)
 static int	 fts_ufslinks(FTS *, const FTSENT *);
 #endif
+#if defined(__linux__) && defined(DT_UNKNOWN)
+static int	 fts_dtype(FTS *, FTSENT *, unsigned char);
+#endif
+#if defined(__linux__) && defined(STATX_TYPE)
+static int	 fts_fstatat(int, const char *, struct stat *, int);
+static void	 fts_statx_to_stat(const struct statx *, struct stat *);
+#else
+#define	fts_fstatat	fstatat
+#endif
 
 #define	ISDOT(a)	(a[0] == '.' && (!a[1] || (a[1] == '.' && !a[2])))
 
@@ -163,8 +197,57 @@ struct _fts_private {
 
 	dev_t		ftsp_dev;
 	int		ftsp_linksreliable;
+
+#if defined(FTS_URING)
+	struct fts_uring *ftsp_uring;	/* ring, set up on first use */
+	int		ftsp_nouring;	/* io_uring(7) unavailable */
+	FTSENT		**ftsp_pending;	/* entries to stat */
+	size_t		ftsp_npending;	/* number of allocated entries */
+#endif
+};
+
+#if defined(FTS_URING)
+/*
+ * Entries of directories holding at least FTS_URING_MIN_ENTRIES entries to
+ * stat are stat()ed through an io_uring(7) instance, keeping up to
+ * FTS_URING_ENTRIES statx(2) requests in flight.  This mostly helps network
+ * file systems, where each stat call is a round-trip to the server.
+ */
+#if !defined(FTS_URING_MIN_ENTRIES)
+#define	FTS_URING_MIN_ENTRIES	32
+#endif
+#if !defined(FTS_URING_ENTRIES)
+#define	FTS_URING_ENTRIES	128
+#endif
+
+struct fts_uring {
+	int		fu_fd;		/* ring fd */
+	void		*fu_sq_ring;	/* submission queue ring mapping */
+	size_t		fu_sq_ring_size;
+	void		*fu_cq_ring;	/* completion queue ring mapping */
+	size_t		fu_cq_ring_size;
+	struct io_uring_sqe *fu_sqes;	/* submission queue entries */
+	size_t		fu_sqes_size;
+	unsigned	*fu_sq_head;
+	unsigned	*fu_sq_tail;
+	unsigned	*fu_sq_mask;
+	unsigned	*fu_sq_array;
+	unsigned	*fu_cq_head;
+	unsigned	*fu_cq_tail;
+	unsigned	*fu_cq_mask;
+	struct io_uring_cqe *fu_cqes;
+	unsigned	fu_entries;	/* number of request slots */
+	struct statx	*fu_stx;	/* statx(2) buffer of each slot */
+	size_t		*fu_item;	/* pending entry of each slot */
+	unsigned	*fu_free;	/* stack of free slots */
+	unsigned	fu_nfree;	/* number of free slots */
 };
 
+static struct fts_uring *fts_uring_open(void);
+static void	 fts_uring_close(struct fts_uring *);
+static void	 fts_uring_stat(FTS *, FTSENT **, size_t, int);
+#endif
+
 #if !defined(__linux__)
 /*
  * The "FTS_NOSTAT" option can avoid a lot of calls to stat(2) if it
@@ -346,6 +429,12 @@ fts_close(FTS *sp)
 	if (sp->fts_array)
 		free(sp->fts_array);
 	free(sp->fts_path);
+#if defined(FTS_URING)
+	if (((struct _fts_private *)sp)->ftsp_uring != NULL)
+		fts_uring_close(((struct _fts_private *)sp)->ftsp_uring);
+	if (((struct _fts_private *)sp)->ftsp_pending != NULL)
+		free(((struct _fts_private *)sp)->ftsp_pending);
+#endif
 
 	/* Return to original directory, save errno if necessary. */
 	if (!ISSET(FTS_NOCHDIR)) {
@@ -575,6 +664,8 @@ name:		t = sp->fts_path + NAPPEND(p->fts_parent);
 int
 fts_set(FTS *sp, FTSENT *p, int instr)
 {
+	(void)sp;
+
 	if (instr != 0 && instr != FTS_AGAIN && instr != FTS_FOLLOW &&
 	    instr != FTS_NOINSTR && instr != FTS_SKIP) {
 		errno = EINVAL;
@@ -683,6 +774,19 @@ fts_set_clientptr(FTS *sp, void *clientptr)
 	sp->fts_clientptr = clientptr;
 }
 
+/*
+ * Use a cache of directory listings : when a directory is to be read, its
+ * listing is first looked up in the cache, and listings read from the file
+ * system (or the cache) are recorded to it.  Only used when stat information
+ * is requested (no FTS_NOSTAT).
+ */
+void
+fts_set_cache(FTS *sp, const FTSCACHE *cache)
+{
+
+	sp->fts_cache = cache;
+}
+
 /*
  * This is the tricky part -- do not casually change *anything* in here.  The
  * idea is to build the linked list of entries that are used by fts_children
@@ -713,10 +817,23 @@ fts_build(FTS *sp, int type)
 	long level;
 	long nlinks;	/* has to be signed because -1 is a magic value */
 	size_t dnamlen, len, maxlen, nitems;
+#if defined(FTS_URING)
+	struct _fts_private *priv;
+	FTSENT **pending;
+	size_t npending, i;
+
+	priv = (struct _fts_private *)sp;
+	npending = 0;
+#endif
 
 	/* Set current node pointer. */
 	cur = sp->fts_cur;
 
+	/* Use cached listing, if any. */
+	if (type == BREAD && sp->fts_cache != NULL && !ISSET(FTS_NOSTAT) &&
+	    fts_build_cached(sp, &head))
+		return (head);
+
 	/*
 	 * Open the directory for reading.  If this fails, we're done.
 	 * If being called from fts_read, set the fts_info field.
@@ -880,6 +997,30 @@ mem1:				saved_errno = errno;
 			p->fts_accpath =
 			    ISSET(FTS_NOCHDIR) ? p->fts_path : p->fts_name;
 			p->fts_info = FTS_NSOK;
+#if defined(__linux__) && defined(DT_UNKNOWN)
+		} else if ((p->fts_info = fts_dtype(sp, p, dp->d_type)) != 0) {
+			p->fts_accpath =
+			    ISSET(FTS_NOCHDIR) ? p->fts_path : p->fts_name;
+#endif
+#if defined(FTS_URING)
+		} else if (!priv->ftsp_nouring &&
+		    (npending < priv->ftsp_npending ||
+		    (pending = realloc(priv->ftsp_pending,
+		    (priv->ftsp_npending + FTS_URING_ENTRIES) *
+		    sizeof(FTSENT *))) != NULL)) {
+			/*
+			 * Stat later, once the whole directory has been read
+			 * (nlinks is always -1 here).
+			 */
+			if (npending == priv->ftsp_npending) {
+				priv->ftsp_pending = pending;
+				priv->ftsp_npending += FTS_URING_ENTRIES;
+			}
+			p->fts_accpath =
+			    ISSET(FTS_NOCHDIR) ? p->fts_path : p->fts_name;
+			p->fts_info = FTS_INIT;
+			priv->ftsp_pending[npending++] = p;
+#endif
 		} else {
 			/* Build a file name for fts_stat to stat. */
 			if (ISSET(FTS_NOCHDIR)) {
@@ -907,6 +1048,32 @@ mem1:				saved_errno = errno;
 		}
 		++nitems;
 	}
+#if defined(FTS_URING)
+	/*
+	 * Stat pending entries : asynchronously for large directories, then
+	 * synchronously for those the ring did not handle (errors included,
+	 * so that fts_stat() sets them up).
+	 */
+	if (npending > 0) {
+		if (npending >= FTS_URING_MIN_ENTRIES &&
+		    priv->ftsp_uring == NULL &&
+		    (priv->ftsp_uring = fts_uring_open()) == NULL)
+			priv->ftsp_nouring = 1;
+		if (npending >= FTS_URING_MIN_ENTRIES &&
+		    priv->ftsp_uring != NULL && !priv->ftsp_nouring)
+			fts_uring_stat(sp, priv->ftsp_pending, npending,
+			    _dirfd(dirp));
+		for (i = 0; i < npending; i++) {
+			p = priv->ftsp_pending[i];
+			if (p->fts_info != FTS_INIT)
+				continue;
+			if (ISSET(FTS_NOCHDIR))
+				p->fts_info = fts_stat(sp, p, 0, _dirfd(dirp));
+			else
+				p->fts_info = fts_stat(sp, p, 0, -1);
+		}
+	}
+#endif
 	if (dirp)
 		(void)closedir(dirp);
 
@@ -924,6 +1091,11 @@ mem1:				saved_errno = errno;
 	if (ISSET(FTS_NOCHDIR))
 		sp->fts_path[cur->fts_pathlen] = '\0';
 
+	/* Record listing (in directory order), unless stats failed. */
+	if (type == BREAD && sp->fts_cache != NULL && !ISSET(FTS_NOSTAT) &&
+	    !cderrno)
+		sp->fts_cache->fc_store(sp->fts_cache->fc_arg, cur, head);
+
 	/*
 	 * If descended after called from fts_children or after called from
 	 * fts_read and nothing found, get back.  At the root level we use
@@ -954,12 +1126,151 @@ mem1:				saved_errno = errno;
 	return (head);
 }
 
+/*
+ * Build the list of entries of the current directory from its cached
+ * listing, as fts_build() would do when reading it.  Returns 0 if there is
+ * no cached listing (or if we cannot cd to the directory), else 1 and sets
+ * *headp.
+ */
+static int
+fts_build_cached(FTS *sp, FTSENT **headp)
+{
+	const FTSCACHEENT *ce;
+	FTSENT *p, *head;
+	FTSENT *cur, *tail;
+	void *oldaddr;
+	char *cp;
+	int saved_errno, doadjust;
+	long level;
+	size_t len, maxlen, nitems, nentries, i;
+
+	/* Set current node pointer. */
+	cur = sp->fts_cur;
+
+	if ((ce = sp->fts_cache->fc_lookup(sp->fts_cache->fc_arg, cur,
+	    &nentries)) == NULL)
+		return (0);
+
+	/* Cd to the directory, as fts_build() would do. */
+	if (fts_safe_changedir(sp, cur, -1, cur->fts_accpath))
+		return (0);
+
+	/* See fts_build(). */
+	len = NAPPEND(cur);
+	if (ISSET(FTS_NOCHDIR)) {
+		cp = sp->fts_path + len;
+		*cp++ = '/';
+	} else {
+		/* GCC, you're too verbose. */
+		cp = NULL;
+	}
+	len++;
+	maxlen = sp->fts_pathlen - len;
+
+	level = cur->fts_level + 1;
+
+	doadjust = 0;
+	for (head = tail = NULL, nitems = 0, i = 0; i < nentries; i++) {
+		if ((p = fts_alloc(sp, (char *)ce[i].fce_name,
+		    ce[i].fce_namelen)) == NULL)
+			goto mem1;
+		if (ce[i].fce_namelen >= maxlen) {	/* include space for NUL */
+			oldaddr = sp->fts_path;
+			if (fts_palloc(sp, ce[i].fce_namelen + len + 1)) {
+				/*
+				 * No more memory for path or structures.  Save
+				 * errno, free up the current structure and the
+				 * structures already allocated.
+				 */
+mem1:				saved_errno = errno;
+				if (p)
+					free(p);
+				fts_lfree(head);
+				cur->fts_info = FTS_ERR;
+				SET(FTS_STOP);
+				errno = saved_errno;
+				*headp = NULL;
+				return (1);
+			}
+			/* Did realloc() change the pointer? */
+			if (oldaddr != sp->fts_path) {
+				doadjust = 1;
+				if (ISSET(FTS_NOCHDIR))
+					cp = sp->fts_path + len;
+			}
+			maxlen = sp->fts_pathlen - len;
+		}
+
+		p->fts_level = level;
+		p->fts_parent = sp->fts_cur;
+		p->fts_pathlen = len + ce[i].fce_namelen;
+
+		switch (ce[i].fce_info) {
+		case FTS_F:
+		case FTS_SL:
+		case FTS_SLNONE:
+		case FTS_DEFAULT:
+			/* Nothing to descend into, trust cached information. */
+			p->fts_accpath =
+			    ISSET(FTS_NOCHDIR) ? p->fts_path : p->fts_name;
+			memset(p->fts_statp, 0, sizeof(struct stat));
+			p->fts_statp->st_mode = ce[i].fce_mode;
+			p->fts_statp->st_size = ce[i].fce_size;
+			p->fts_info = ce[i].fce_info;
+			break;
+		default:
+			/* Build a file name for fts_stat to stat. */
+			if (ISSET(FTS_NOCHDIR)) {
+				p->fts_accpath = p->fts_path;
+				memmove(cp, p->fts_name, p->fts_namelen + 1);
+			} else
+				p->fts_accpath = p->fts_name;
+			p->fts_info = fts_stat(sp, p, 0, -1);
+			break;
+		}
+
+		p->fts_link = NULL;
+		if (head == NULL)
+			head = tail = p;
+		else {
+			tail->fts_link = p;
+			tail = p;
+		}
+		++nitems;
+	}
+
+	if (doadjust)
+		fts_padjust(sp, head);
+
+	if (ISSET(FTS_NOCHDIR))
+		sp->fts_path[cur->fts_pathlen] = '\0';
+
+	/* Record listing again, with up-to-date directories. */
+	sp->fts_cache->fc_store(sp->fts_cache->fc_arg, cur, head);
+
+	/* Nothing found, get back (see fts_build()). */
+	if (!nitems) {
+		if (cur->fts_level == FTS_ROOTLEVEL ?
+		    FCHDIR(sp, sp->fts_rfd) :
+		    fts_safe_changedir(sp, cur->fts_parent, -1, "..")) {
+			cur->fts_info = FTS_ERR;
+			SET(FTS_STOP);
+		} else
+			cur->fts_info = FTS_DP;
+		*headp = NULL;
+		return (1);
+	}
+
+	/* Sort the entries. */
+	if (sp->fts_compar && nitems > 1)
+		head = fts_sort(sp, head, nitems);
+	*headp = head;
+	return (1);
+}
+
 static int
 fts_stat(FTS *sp, FTSENT *p, int follow, int dfd)
 {
-	FTSENT *t;
-	dev_t dev;
-	ino_t ino;
 	struct stat *sbp, sb;
 	int saved_errno;
 	const char *path;
@@ -989,9 +1300,9 @@ fts_stat(FTS *sp, FTSENT *p, int follow, int dfd)
 	 * fail, set the errno from the stat call.
 	 */
 	if (ISSET(FTS_LOGICAL) || follow) {
-		if (fstatat(dfd, path, sbp, 0)) {
+		if (fts_fstatat(dfd, path, sbp, 0)) {
 			saved_errno = errno;
-			if (fstatat(dfd, path, sbp, AT_SYMLINK_NOFOLLOW)) {
+			if (fts_fstatat(dfd, path, sbp, AT_SYMLINK_NOFOLLOW)) {
 				p->fts_errno = saved_errno;
 				goto err;
 			}
@@ -999,12 +1310,25 @@ fts_stat(FTS *sp, FTSENT *p, int follow, int dfd)
 			if (S_ISLNK(sbp->st_mode))
 				return (FTS_SLNONE);
 		}
-	} else if (fstatat(dfd, path, sbp, AT_SYMLINK_NOFOLLOW)) {
+	} else if (fts_fstatat(dfd, path, sbp, AT_SYMLINK_NOFOLLOW)) {
 		p->fts_errno = errno;
 err:		memset(sbp, 0, sizeof(struct stat));
 		return (FTS_NS);
 	}
 
+	return (fts_stat_info(p, sbp));
+}
+
+/*
+ * Set up entry p from its stat information and return its fts_info value.
+ */
+static int
+fts_stat_info(FTSENT *p, struct stat *sbp)
+{
+	FTSENT *t;
+	dev_t dev;
+	ino_t ino;
+
 	if (S_ISDIR(sbp->st_mode)) {
 		/*
 		 * Set the device/inode.  Used to find cycles and check for
@@ -1041,6 +1365,298 @@ err:		memset(sbp, 0, sizeof(struct stat));
 	return (FTS_DEFAULT);
 }
 
+#if defined(__linux__) && defined(DT_UNKNOWN)
+/*
+ * Entries whose type is known from their directory entry and which are
+ * neither directories nor regular files have no size and nothing to descend
+ * into : fill in their mode instead of calling stat.  Symbolic links must
+ * still be stat()ed for a logical walk.  Returns the fts_info value for the
+ * entry, or 0 if it must be stat()ed.
+ */
+static int
+fts_dtype(FTS *sp, FTSENT *p, unsigned char d_type)
+{
+	mode_t mode;
+
+	switch (d_type) {
+	case DT_LNK:
+		if (ISSET(FTS_LOGICAL))
+			return (0);
+		mode = S_IFLNK;
+		break;
+	case DT_FIFO:
+		mode = S_IFIFO;
+		break;
+	case DT_CHR:
+		mode = S_IFCHR;
+		break;
+	case DT_BLK:
+		mode = S_IFBLK;
+		break;
+	case DT_SOCK:
+		mode = S_IFSOCK;
+		break;
+	default:
+		return (0);
+	}
+
+	if (!ISSET(FTS_NOSTAT)) {
+		memset(p->fts_statp, 0, sizeof(struct stat));
+		p->fts_statp->st_mode = mode;
+	}
+	return (S_ISLNK(mode) ? FTS_SL : FTS_DEFAULT);
+}
+#endif
+
+#if defined(__linux__) && defined(STATX_TYPE)
+/*
+ * fstatat(2) replacement using statx(2) : only request the fields we use and
+ * let network file systems answer from their attribute cache.  Falls back to
+ * fstatat(2) if statx(2) is not supported by the running kernel.
+ */
+static int
+fts_fstatat(int dfd, const char *path, struct stat *sbp, int flag)
+{
+	static int nostatx = 0;
+	struct statx stx;
+
+	if (!nostatx) {
+		if (statx(dfd, path, flag | AT_STATX_DONT_SYNC, STATX_TYPE |
+		    STATX_MODE | STATX_NLINK | STATX_INO | STATX_SIZE |
+		    STATX_MTIME | STATX_CTIME, &stx) == 0) {
+			fts_statx_to_stat(&stx, sbp);
+			return (0);
+		}
+		if (errno != ENOSYS)
+			return (-1);
+		nostatx = 1;
+	}
+	return (fstatat(dfd, path, sbp, flag));
+}
+
+static void
+fts_statx_to_stat(const struct statx *stx, struct stat *sbp)
+{
+
+	memset(sbp, 0, sizeof(struct stat));
+	sbp->st_dev = makedev(stx->stx_dev_major, stx->stx_dev_minor);
+	sbp->st_ino = stx->stx_ino;
+	sbp->st_mode = stx->stx_mode;
+	sbp->st_nlink = stx->stx_nlink;
+	sbp->st_size = stx->stx_size;
+	sbp->st_mtim.tv_sec = stx->stx_mtime.tv_sec;
+	sbp->st_mtim.tv_nsec = stx->stx_mtime.tv_nsec;
+	sbp->st_ctim.tv_sec = stx->stx_ctime.tv_sec;
+	sbp->st_ctim.tv_nsec = stx->stx_ctime.tv_nsec;
+}
+#endif
+
+#if defined(FTS_URING)
+/*
+ * Set up an io_uring(7) instance along with FTS_URING_ENTRIES request slots.
+ * Returns NULL if io_uring(7) is unavailable (old kernel, disabled by
+ * seccomp or sysctl, ...).
+ */
+static struct fts_uring *
+fts_uring_open(void)
+{
+	struct io_uring_params params;
+	struct fts_uring *ur;
+	unsigned i;
+
+	if ((ur = calloc(1, sizeof(*ur))) == NULL)
+		return (NULL);
+	ur->fu_sq_ring = ur->fu_cq_ring = ur->fu_sqes = MAP_FAILED;
+
+	memset(&params, 0, sizeof(params));
+	if ((ur->fu_fd = (int)syscall(__NR_io_uring_setup, FTS_URING_ENTRIES,
+	    &params)) < 0) {
+		free(ur);
+		return (NULL);
+	}
+
+	ur->fu_sq_ring_size = params.sq_off.array +
+	    params.sq_entries * sizeof(unsigned);
+	ur->fu_cq_ring_size = params.cq_off.cqes +
+	    params.cq_entries * sizeof(struct io_uring_cqe);
+	if (params.features & IORING_FEAT_SINGLE_MMAP) {
+		if (ur->fu_cq_ring_size > ur->fu_sq_ring_size)
+			ur->fu_sq_ring_size = ur->fu_cq_ring_size;
+		ur->fu_cq_ring_size = 0;
+	}
+	ur->fu_sq_ring = mmap(NULL, ur->fu_sq_ring_size,
+	    PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ur->fu_fd,
+	    IORING_OFF_SQ_RING);
+	if (ur->fu_sq_ring == MAP_FAILED)
+		goto err;
+	if (ur->fu_cq_ring_size == 0)
+		ur->fu_cq_ring = ur->fu_sq_ring;
+	else {
+		ur->fu_cq_ring = mmap(NULL, ur->fu_cq_ring_size,
+		    PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+		    ur->fu_fd, IORING_OFF_CQ_RING);
+		if (ur->fu_cq_ring == MAP_FAILED)
+			goto err;
+	}
+	ur->fu_sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+	ur->fu_sqes = mmap(NULL, ur->fu_sqes_size, PROT_READ | PROT_WRITE,
+	    MAP_SHARED | MAP_POPULATE, ur->fu_fd, IORING_OFF_SQES);
+	if (ur->fu_sqes == MAP_FAILED)
+		goto err;
+
+	ur->fu_sq_head = (unsigned *)((char *)ur->fu_sq_ring +
+	    params.sq_off.head);
+	ur->fu_sq_tail = (unsigned *)((char *)ur->fu_sq_ring +
+	    params.sq_off.tail);
+	ur->fu_sq_mask = (unsigned *)((char *)ur->fu_sq_ring +
+	    params.sq_off.ring_mask);
+	ur->fu_sq_array = (unsigned *)((char *)ur->fu_sq_ring +
+	    params.sq_off.array);
+	ur->fu_cq_head = (unsigned *)((char *)ur->fu_cq_ring +
+	    params.cq_off.head);
+	ur->fu_cq_tail = (unsigned *)((char *)ur->fu_cq_ring +
+	    params.cq_off.tail);
+	ur->fu_cq_mask = (unsigned *)((char *)ur->fu_cq_ring +
+	    params.cq_off.ring_mask);
+	ur->fu_cqes = (struct io_uring_cqe *)((char *)ur->fu_cq_ring +
+	    params.cq_off.cqes);
+
+	/* Never have more requests in flight than the submission queue holds. */
+	ur->fu_entries = params.sq_entries;
+	if ((ur->fu_stx = calloc(ur->fu_entries, sizeof(struct statx))) ==
+	    NULL ||
+	    (ur->fu_item = calloc(ur->fu_entries, sizeof(size_t))) == NULL ||
+	    (ur->fu_free = calloc(ur->fu_entries, sizeof(unsigned))) == NULL)
+		goto err;
+	for (i = 0; i < ur->fu_entries; i++)
+		ur->fu_free[i] = i;
+	ur->fu_nfree = ur->fu_entries;
+	return (ur);
+
+err:
+	fts_uring_close(ur);
+	return (NULL);
+}
+
+static void
+fts_uring_close(struct fts_uring *ur)
+{
+
+	if (ur->fu_sqes != MAP_FAILED)
+		(void)munmap(ur->fu_sqes, ur->fu_sqes_size);
+	if (ur->fu_cq_ring != MAP_FAILED && ur->fu_cq_ring != ur->fu_sq_ring)
+		(void)munmap(ur->fu_cq_ring, ur->fu_cq_ring_size);
+	if (ur->fu_sq_ring != MAP_FAILED)
+		(void)munmap(ur->fu_sq_ring, ur->fu_sq_ring_size);
+	(void)_close(ur->fu_fd);
+	free(ur->fu_stx);
+	free(ur->fu_item);
+	free(ur->fu_free);
+	free(ur);
+}
+
+/*
+ * Stat the n entries of pending, relative to directory dfd, through the
+ * ring : requests are submitted as long as slots are free and completions
+ * are consumed as they arrive.  Entries whose request failed are left
+ * FTS_INIT, for fts_build() to stat them synchronously (fts_stat() handles
+ * errors and dangling symbolic links).  The ring is given up on if it
+ * cannot be used (IORING_OP_STATX not supported, unexpected error, no
+ * request can be submitted), the remaining entries being left FTS_INIT too.
+ * Requests queued but not consumed by the kernel yet (short submission,
+ * EAGAIN or EBUSY) are submitted again on next pass; the kernel is only
+ * waited for when requests are in flight.
+ */
+static void
+fts_uring_stat(FTS *sp, FTSENT **pending, size_t n, int dfd)
+{
+	struct _fts_private *priv;
+	struct fts_uring *ur;
+	struct io_uring_sqe *sqe;
+	struct io_uring_cqe *cqe;
+	struct stat *sbp, sb;
+	FTSENT *p;
+	unsigned head, tail, slot, queued, inflight;
+	size_t next;
+	int ret;
+
+	priv = (struct _fts_private *)sp;
+	ur = priv->ftsp_uring;
+	for (next = 0;;) {
+		/* Queue requests. */
+		tail = *ur->fu_sq_tail;
+		while (next < n && !priv->ftsp_nouring && ur->fu_nfree > 0) {
+			slot = ur->fu_free[--ur->fu_nfree];
+			ur->fu_item[slot] = next;
+			sqe = &ur->fu_sqes[tail & *ur->fu_sq_mask];
+			memset(sqe, 0, sizeof(*sqe));
+			sqe->opcode = IORING_OP_STATX;
+			sqe->fd = dfd;
+			sqe->addr = (uintptr_t)pending[next]->fts_name;
+			sqe->len = STATX_TYPE | STATX_MODE | STATX_NLINK |
+			    STATX_INO | STATX_SIZE | STATX_MTIME | STATX_CTIME;
+			sqe->statx_flags = AT_STATX_DONT_SYNC |
+			    (ISSET(FTS_LOGICAL) ? 0 : AT_SYMLINK_NOFOLLOW);
+			sqe->off = (uintptr_t)&ur->fu_stx[slot];
+			sqe->user_data = slot;
+			ur->fu_sq_array[tail & *ur->fu_sq_mask] =
+			    tail & *ur->fu_sq_mask;
+			tail++;
+			next++;
+		}
+		__atomic_store_n(ur->fu_sq_tail, tail, __ATOMIC_RELEASE);
+
+		/*
+		 * Requests queued but not consumed by the kernel yet, and
+		 * requests in flight.
+		 */
+		queued = tail - __atomic_load_n(ur->fu_sq_head,
+		    __ATOMIC_ACQUIRE);
+		inflight = ur->fu_entries - ur->fu_nfree - queued;
+		if (queued == 0 && inflight == 0)
+			break;
+
+		/*
+		 * Submit them and, if requests are in flight, wait for at
+		 * least one completion.
+		 */
+		ret = (int)syscall(__NR_io_uring_enter, ur->fu_fd, queued,
+		    inflight > 0 ? 1 : 0,
+		    inflight > 0 ? IORING_ENTER_GETEVENTS : 0, NULL, 0);
+		if ((ret < 0 && errno != EINTR && errno != EAGAIN &&
+		    errno != EBUSY) ||
+		    (inflight == 0 && (ret == 0 || (ret < 0 && errno != EINTR)))) {
+			/*
+			 * Unexpected error, or nothing could be submitted
+			 * while nothing is in flight (nothing to wait for).
+			 * Requests may still be in flight : do not re-use
+			 * their slots, nor the ring.
+			 */
+			priv->ftsp_nouring = 1;
+			return;
+		}
+
+		/* Consume completions. */
+		head = *ur->fu_cq_head;
+		tail = __atomic_load_n(ur->fu_cq_tail, __ATOMIC_ACQUIRE);
+		for (; head != tail; head++) {
+			cqe = &ur->fu_cqes[head & *ur->fu_cq_mask];
+			slot = (unsigned)cqe->user_data;
+			p = pending[ur->fu_item[slot]];
+			if (cqe->res == 0) {
+				sbp = ISSET(FTS_NOSTAT) ? &sb : p->fts_statp;
+				fts_statx_to_stat(&ur->fu_stx[slot], sbp);
+				p->fts_info = fts_stat_info(p, sbp);
+			} else if (cqe->res == -EINVAL ||
+			    cqe->res == -EOPNOTSUPP)
+				priv->ftsp_nouring = 1;
+			ur->fu_free[ur->fu_nfree++] = slot;
+		}
+		__atomic_store_n(ur->fu_cq_head, head, __ATOMIC_RELEASE);
+	}
+}
+#endif
+
 /*
  * The comparison function takes pointers to pointers to FTSENT structures.
  * Qsort wants a comparison function that takes pointers to void.
@@ -93,6 +93,7 @@ typedef struct {
 #define	FTS_STOP	0x200		/* (private) unrecoverable error */
 	int fts_options;		/* fts_open options, global flags */
 	void *fts_clientptr;		/* thunk for sort function */
+	const struct _ftscache *fts_cache; /* listings cache (non-std) */
 } FTS;
 
 typedef struct _ftsent {
@@ -149,6 +150,28 @@ typedef struct _ftsent {
 	FTS *fts_fts;			/* back pointer to main FTS */
 } FTSENT;
 
+/*
+ * Cache of directory listings (non-std, see fts_set_cache()) : a listing
+ * gives, for each entry, its name, fts_info value, mode and size.  Entries
+ * that are not directories (FTS_F, FTS_SL, FTS_SLNONE, FTS_DEFAULT) are
+ * returned as listed, others are stat()ed again.
+ */
+typedef struct {
+	const char *fce_name;		/* file name */
+	__size_t fce_namelen;		/* strlen(fce_name) */
+	int fce_info;			/* fts_info */
+	unsigned int fce_mode;		/* st_mode */
+	long long fce_size;		/* st_size */
+} FTSCACHEENT;
+
+typedef struct _ftscache {
+	/* listing of directory (NULL if unknown), sets number of entries */
+	const FTSCACHEENT *(*fc_lookup)(void *, const FTSENT *, __size_t *);
+	/* record listing of directory, given its list of entries */
+	void (*fc_store)(void *, const FTSENT *, const FTSENT *);
+	void *fc_arg;			/* first argument of functions */
+} FTSCACHE;
+
 #if defined(__FreeBSD__)
 #include <sys/cdefs.h>
 
@@ -164,6 +187,7 @@ FTS	*fts_open(char * const *, int,
 	    int (*)(const FTSENT * const *, const FTSENT * const *));
 FTSENT	*fts_read(FTS *);
 int	 fts_set(FTS *, FTSENT *, int);
+void	 fts_set_cache(FTS *, const FTSCACHE *);
 void	 fts_set_clientptr(FTS *, void *);
 #if defined(__FreeBSD__)
 __END_DECLS
@@ -0,0 +1,627 @@
+/*-
+ * Copyright (c) 2011-2019 Ganael LAPLANCHE <ganael.laplanche@martymac.org>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHORS AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHORS OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include "types.h"
+#include "utils.h"
+#include "options.h"
+#include "file_entry.h"
+#include "crawl.h"
+#include "input.h"
+
+/* fprintf(3) */
+#include <stdio.h>
+
+/* malloc(3), free(3), strtoul(3), strtoull(3) */
+#include <stdlib.h>
+
+/* memchr(3), memmove(3), strerror(3), strchr(3), strncmp(3) */
+#include <string.h>
+
+/* errno */
+#include <errno.h>
+
+/* assert(3) */
+#include <assert.h>
+
+/* LLONG_MAX, UINT_MAX */
+#include <limits.h>
+
+/* read(2), close(2) */
+#include <unistd.h>
+
+/* open(2) */
+#include <fcntl.h>
+
+/* Initialize a reader for file descriptor fd, lines ending with delim
+   - returns 0 (success) or 1 (failure) */
+int
+init_input_reader(struct input_reader *reader, int fd, char delim)
+{
+    assert(reader != NULL);
+    assert(fd >= 0);
+
+    reader->fd = fd;
+    reader->delim = delim;
+    reader->size = INPUT_BUFFER_SIZE;
+    reader->start = 0;
+    reader->end = 0;
+    reader->eof = 0;
+    /* keep room for a '\0' after the last line */
+    if_not_malloc(reader->data, reader->size + 1,
+        return (1);
+    )
+    return (0);
+}
+
+/* Un-initialize a reader (its file descriptor is left open) */
+void
+uninit_input_reader(struct input_reader *reader)
+{
+    assert(reader != NULL);
+
+    if(reader->data != NULL)
+        free(reader->data);
+    reader->data = NULL;
+    reader->size = 0;
+    return;
+}
+
+/* Read more data into reader's buffer, after moving the data not consumed
+   yet to its beginning (and growing it if that data fills it)
+   - sets eof when end of input is reached
+   - returns 0 (success) or -1 (failure) */
+static int
+fill_input_reader(struct input_reader *reader)
+{
+    assert(reader != NULL);
+    assert(!reader->eof);
+
+    if(reader->start > 0) {
+        memmove(reader->data, &reader->data[reader->start],
+            reader->end - reader->start);
+        reader->end -= reader->start;
+        reader->start = 0;
+    }
+    if(reader->end == reader->size) {
+        char *data = reader->data;
+        if_not_realloc(data, (reader->size * 2) + 1,
+            return (-1);
+        )
+        reader->data = data;
+        reader->size *= 2;
+    }
+
+    ssize_t nread;
+    while((nread = read(reader->fd, &reader->data[reader->end],
+        reader->size - reader->end)) < 0) {
+        if(errno != EINTR) {
+            fprintf(stderr, "%s(): %s\n", __func__, strerror(errno));
+            return (-1);
+        }
+    }
+    if(nread == 0)
+        reader->eof = 1;
+    reader->end += nread;
+    return (0);
+}
+
+/* Read next line from reader
+   - line points to the line, within reader's buffer and '\0'-terminated in
+     place of its delimiter ; it remains valid until next call
+   - len is set to its length
+   - a last line without delimiter is returned too
+   - returns 1 (line read), 0 (end of input) or -1 (read error) */
+int
+read_input_line(struct input_reader *reader, char **line, size_t *len)
+{
+    assert(reader != NULL);
+    assert(reader->data != NULL);
+    assert(line != NULL);
+    assert(len != NULL);
+
+    /* part of the line already searched for a delimiter */
+    size_t searched = 0;
+
+    while(1) {
+        char *delim = memchr(&reader->data[reader->start + searched],
+            reader->delim, reader->end - reader->start - searched);
+        if(delim != NULL) {
+            *delim = '\0';
+            *line = &reader->data[reader->start];
+            *len = delim - *line;
+            reader->start = (delim - reader->data) + 1;
+            return (1);
+        }
+        searched = reader->end - reader->start;
+
+        if(reader->eof) {
+            if(reader->start == reader->end)
+                return (0);
+            /* last line, without delimiter */
+            reader->data[reader->end] = '\0';
+            *line = &reader->data[reader->start];
+            *len = reader->end - reader->start;
+            reader->start = reader->end;
+            return (1);
+        }
+
+        if(fill_input_reader(reader) != 0)
+            return (-1);
+    }
+}
+
+/* Read next fixed-size record (of len bytes) from reader
+   - record points to the record, within reader's buffer ; it remains valid
+     until next call
+   - returns 1 (record read), 0 (end of input) or -1 (read error or
+     truncated record) */
+int
+read_input_record(struct input_reader *reader, size_t len, char **record)
+{
+    assert(reader != NULL);
+    assert(reader->data != NULL);
+    assert(len > 0);
+    assert(record != NULL);
+
+    while((reader->end - reader->start) < len) {
+        if(reader->eof) {
+            if(reader->start == reader->end)
+                return (0);
+            fprintf(stderr, "%s(): truncated record\n", __func__);
+            return (-1);
+        }
+        if(fill_input_reader(reader) != 0)
+            return (-1);
+    }
+
+    *record = &reader->data[reader->start];
+    reader->start += len;
+    return (1);
+}
+
+/* White-space characters, as skipped by scanf(3) */
+#define is_input_space(c) \
+    (((c) == ' ') || (((c) >= '\t') && ((c) <= '\r')))
+
+/* Parse a decimal size, optionally preceded by a sign, at *p
+   - *p is moved past the size
+   - returns 0 (success) or 1 (no size or size out of range) */
+static int
+parse_size(char **p, fsize_t *size)
+{
+    char *q = *p;
+    int negative = 0;
+    fsize_t value = 0;
+
+    if((*q == '-') || (*q == '+'))
+        negative = (*q++ == '-');
+    if((*q < '0') || (*q > '9'))
+        return (1);
+    do {
+        int digit = *q++ - '0';
+        if(value > (LLONG_MAX - digit) / 10)
+            return (1);
+        value = (value * 10) + digit;
+    } while((*q >= '0') && (*q <= '9'));
+
+    *size = negative ? -value : value;
+    *p = q;
+    return (0);
+}
+
+/* Parse an arbitrary value line (option -a) : "size(blank)path"
+   - size is a decimal number, optionally preceded by blanks and a sign
+   - path is set to the rest of the line, after blanks, within line (it is
+     not copied) ; it must not be empty
+   - returns 0 (success) or 1 (invalid line or size out of range) */
+int
+parse_arbitrary_value(char *line, fsize_t *size, char **path)
+{
+    assert(line != NULL);
+    assert(size != NULL);
+    assert(path != NULL);
+
+    char *p = line;
+
+    while(is_input_space(*p))
+        p++;
+    if(parse_size(&p, size) != 0)
+        return (1);
+
+    while(is_input_space(*p))
+        p++;
+    if(*p == '\0')
+        return (1);
+
+    *path = p;
+    return (0);
+}
+
+/* Parse an arbitrary value line made of fields separated by sep (options -a
+   and -F tsv or csv)
+   - size and path are read from fields size_field and path_field (starting
+     from 1), other fields are ignored
+   - if quoted is set, fields may be enclosed in double quotes, a double
+     quote being doubled within such a field (CSV) ; path's quotes are
+     removed in place
+   - path is set to point within line (it is not copied) ; it must not be
+     empty
+   - line is only modified on success (to be reported as is otherwise)
+   - returns 0 (success) or 1 (invalid line or size out of range) */
+int
+parse_separated_value(char *line, char sep, unsigned char quoted,
+    unsigned int size_field, unsigned int path_field, fsize_t *size,
+    char **path)
+{
+    assert(line != NULL);
+    assert(size_field > 0);
+    assert(path_field > 0);
+    assert(size_field != path_field);
+    assert(size != NULL);
+    assert(path != NULL);
+
+    char *p = line;
+    unsigned int field;
+    unsigned int last_field = max(size_field, path_field);
+    char *size_start = NULL;
+    char *size_end = NULL;
+    char *path_start = NULL;
+    char *path_end = NULL;
+    unsigned char path_quoted = 0;
+
+    /* locate fields */
+    for(field = 1; field <= last_field; field++) {
+        char *start = p;
+        char *end;
+        unsigned char field_quoted = 0;
+
+        if(quoted && (*p == '"')) {
+            /* skip quoted field, end pointing to its closing quote */
+            field_quoted = 1;
+            start = ++p;
+            while(1) {
+                if(*p == '\0')
+                    return (1);
+                if(*p == '"') {
+                    if(p[1] != '"')
+                        break;
+                    p++;
+                }
+                p++;
+            }
+            end = p++;
+            if((*p != sep) && (*p != '\0'))
+                return (1);
+        }
+        else {
+            while((*p != sep) && (*p != '\0'))
+                p++;
+            end = p;
+        }
+
+        if(field == size_field) {
+            size_start = start;
+            size_end = end;
+        }
+        else if(field == path_field) {
+            path_start = start;
+            path_end = end;
+            path_quoted = field_quoted;
+        }
+
+        if(*p == '\0')
+            break;
+        p++;
+    }
+    if((field < last_field) || (path_start == path_end))
+        return (1);
+
+    /* parse size, its field being terminated temporarily */
+    char next = *size_end;
+    *size_end = '\0';
+    char *q = size_start;
+    while(is_input_space(*q))
+        q++;
+    int error = parse_size(&q, size);
+    while(is_input_space(*q))
+        q++;
+    if(*q != '\0')
+        error = 1;
+    *size_end = next;
+    if(error != 0)
+        return (1);
+
+    /* unquote and terminate path in place */
+    if(path_quoted) {
+        char *src = path_start;
+        char *dst = path_start;
+        while(src < path_end) {
+            if(*src == '"')
+                src++;
+            *dst++ = *src++;
+        }
+        path_end = dst;
+    }
+    *path_end = '\0';
+    *path = path_start;
+
+    return (0);
+}
+
+/* Parse a fixed-size binary record (options -a and -F bin) :
+   - a 64-bit signed size, little-endian
+   - a path, padded with (at least one) null character up to record_size
+   - path is set to point within record (it is not copied) ; it must not be
+     empty
+   - returns 0 (success) or 1 (invalid record) */
+int
+parse_binary_value(char *record, size_t record_size, fsize_t *size,
+    char **path)
+{
+    assert(record != NULL);
+    assert(record_size > INPUT_BINARY_SIZE_LEN);
+    assert(size != NULL);
+    assert(path != NULL);
+
+    const unsigned char *r = (const unsigned char *)record;
+    unsigned long long value = 0;
+    int i;
+
+    for(i = INPUT_BINARY_SIZE_LEN - 1; i >= 0; i--)
+        value = (value << 8) | r[i];
+
+    char *p = record + INPUT_BINARY_SIZE_LEN;
+    if((*p == '\0') ||
+        (memchr(p, '\0', record_size - INPUT_BINARY_SIZE_LEN) == NULL))
+        return (1);
+
+    *size = (fsize_t)value;
+    *path = p;
+    return (0);
+}
+
+/* Parse an arbitrary value record (option -a) using input format of
+   options (option -F)
+   - see parse_*_value() functions above
+   - returns 0 (success) or 1 (invalid record) */
+int
+parse_input_value(char *record, const struct program_options *options,
+    fsize_t *size, char **path)
+{
+    assert(record != NULL);
+    assert(options != NULL);
+
+    switch(options->in_format) {
+        case OPT_INFORMAT_TSV:
+            return (parse_separated_value(record, '\t', 0,
+                options->in_size_field, options->in_path_field, size, path));
+        case OPT_INFORMAT_CSV:
+            return (parse_separated_value(record, ',', 1,
+                options->in_size_field, options->in_path_field, size, path));
+        case OPT_INFORMAT_BIN:
+            return (parse_binary_value(record, options->in_record_size,
+                size, path));
+        case OPT_INFORMAT_TEXT:
+        default:
+            return (parse_arbitrary_value(record, size, path));
+    }
+}
+
+/* Set input format of options from option -F argument :
+   "text", "tsv[:size,path]", "csv[:size,path]" or "bin:record_size"
+   - returns 0 (success) or 1 (invalid format) */
+int
+set_input_format(const char *format, struct program_options *options)
+{
+    assert(format != NULL);
+    assert(options != NULL);
+
+    const char *args = strchr(format, ':');
+    size_t name_len = (args != NULL) ? (size_t)(args - format) :
+        strlen(format);
+    char *endptr = NULL;
+
+    if((name_len == 4) && (strncmp(format, "text", 4) == 0) &&
+        (args == NULL)) {
+        options->in_format = OPT_INFORMAT_TEXT;
+        return (0);
+    }
+
+    if((name_len == 3) && ((strncmp(format, "tsv", 3) == 0) ||
+        (strncmp(format, "csv", 3) == 0))) {
+        unsigned long size_field = DFLT_OPT_INSIZEFIELD;
+        unsigned long path_field = DFLT_OPT_INPATHFIELD;
+        if(args != NULL) {
+            size_field = strtoul(args + 1, &endptr, 10);
+            if((endptr == args + 1) || (*endptr != ','))
+                return (1);
+            args = endptr + 1;
+            path_field = strtoul(args, &endptr, 10);
+            if((endptr == args) || (*endptr != '\0'))
+                return (1);
+        }
+        if((size_field == 0) || (path_field == 0) ||
+            (size_field > UINT_MAX) || (path_field > UINT_MAX) ||
+            (size_field == path_field))
+            return (1);
+        options->in_format = (format[0] == 't') ?
+            OPT_INFORMAT_TSV : OPT_INFORMAT_CSV;
+        options->in_size_field = (unsigned int)size_field;
+        options->in_path_field = (unsigned int)path_field;
+        return (0);
+    }
+
+    if((name_len == 3) && (strncmp(format, "bin", 3) == 0) &&
+        (args != NULL)) {
+        /* room for a size, a path and its ending null character */
+        unsigned long long record_size = strtoull(args + 1, &endptr, 10);
+        if((endptr == args + 1) || (*endptr != '\0') ||
+            (record_size < INPUT_BINARY_SIZE_LEN + 2) ||
+            (record_size > INPUT_BUFFER_SIZE))
+            return (1);
+        options->in_format = OPT_INFORMAT_BIN;
+        options->in_record_size = (size_t)record_size;
+        return (0);
+    }
+
+    return (1);
+}
+
+/* Handle one argument (either a path to crawl or an arbitrary value) and
+   add or display file entries
+   - when working within a crawling task, entries are handed over to the
+     crawler (store and count are unused)
+   - else, updates count with the number of entries added
+   - argument may be modified (its path is handed over in place)
+   - returns != 0 if a critical error occurred */
+int
+handle_input_argument(char *argument, struct crawl_task *task,
+    struct file_entry_store *store, fnum_t *count,
+    struct program_options *options)
+{
+    assert(argument != NULL);
+    assert((task != NULL) || (store != NULL));
+    assert((task != NULL) || (count != NULL));
+    assert(options != NULL);
+
+    if(options->arbitrary_values == OPT_ARBITRARYVALUES) {
+    /* handle arbitrary values, path being handed over in place */
+        fsize_t input_size = 0;
+        char *input_path = NULL;
+
+        if(parse_input_value(argument, options, &input_size,
+            &input_path) != 0) {
+            if(options->in_format == OPT_INFORMAT_BIN)
+                fprintf(stderr, "error parsing input record\n");
+            else
+                fprintf(stderr, "error parsing input values: %s\n",
+                    argument);
+            return (0);
+        }
+
+        if(task != NULL) {
+            if(crawl_add_file_entry(task, input_path, input_size,
+                options) != 0) {
+                fprintf(stderr, "%s(): cannot add file entry\n", __func__);
+                return (1);
+            }
+        }
+        else {
+            if(handle_file_entry(store, input_path, input_size,
+                options) != 0) {
+                fprintf(stderr, "%s(): cannot add file entry\n", __func__);
+                return (1);
+            }
+            (*count)++;
+        }
+    }
+    else {
+    /* handle paths, must examine filesystem */
+        char *input_path = argument;
+        size_t input_path_len = strlen(argument);
+
+        /* remove multiple ending slashes (in place) */
+        while((input_path_len > 1) &&
+            (input_path[input_path_len - 1] == '/')  &&
+            (input_path[input_path_len - 2] == '/')) {
+            input_path[input_path_len - 1] = '\0';
+            input_path_len--;
+        }
+
+        /* crawl path */
+        if(input_path[0] != '\0') {
+#if defined(DEBUG)
+            fprintf(stderr, "init_file_entries(): examining %s\n",
+                input_path);
+#endif
+            if(((task != NULL) ?
+                walk_file_entries(input_path, task, NULL, NULL, options) :
+                init_file_entries(input_path, store, count, options)) != 0) {
+                fprintf(stderr, "%s(): cannot initialize file entries\n",
+                    __func__);
+                return (1);
+            }
+        }
+    }
+
+    return (0);
+}
+
+/* Read input file filename (option -i, "-" meaning stdin) and handle each
+   of its records (see handle_input_argument())
+   - returns != 0 if a critical error occurred */
+int
+handle_input_file(const char *filename, struct crawl_task *task,
+    struct file_entry_store *store, fnum_t *count,
+    struct program_options *options)
+{
+    assert(filename != NULL);
+    assert(options != NULL);
+
+    /* handle fd opening */
+    int in_fd = -1;
+    if((filename[0] == '-') && (filename[1] == '\0')) {
+        /* working from stdin */
+        in_fd = STDIN_FILENO;
+    }
+    else {
+        /* working from a filename */
+        if((in_fd = open(filename, O_RDONLY)) < 0) {
+            fprintf(stderr, "%s: %s\n", filename, strerror(errno));
+            return (1);
+        }
+    }
+
+    /* read fd and do the work, records being handled in place */
+    struct input_reader reader;
+    char *record = NULL;
+    size_t record_len = 0;
+    int retval = 0;
+    if(init_input_reader(&reader, in_fd,
+        (options->in_zero == OPT_IN0) ? '\0' : '\n') != 0) {
+        if(in_fd != STDIN_FILENO)
+            close(in_fd);
+        return (1);
+    }
+    while((retval = ((options->in_format == OPT_INFORMAT_BIN) ?
+        read_input_record(&reader, options->in_record_size, &record) :
+        read_input_line(&reader, &record, &record_len))) == 1) {
+        if(handle_input_argument(record, task, store, count, options) != 0) {
+            retval = 2;
+            break;
+        }
+    }
+
+    /* check for error reading input (not critical) */
+    if(retval < 0)
+        fprintf(stderr, "%s: error reading from input stream\n", filename);
+
+    /* cleanup */
+    uninit_input_reader(&reader);
+    if(in_fd != STDIN_FILENO)
+        close(in_fd);
+    return ((retval == 2) ? 1 : 0);
+}
@@ -0,0 +1,79 @@
+/*-
+ * Copyright (c) 2011-2019 Ganael LAPLANCHE <ganael.laplanche@martymac.org>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHORS AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHORS OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef _INPUT_H
+#define _INPUT_H
+
+#include "types.h"
+#include "options.h"
+#include "file_entry.h"
+
+/* size_t */
+#include <stddef.h>
+
+#if !defined(INPUT_BUFFER_SIZE)
+#define INPUT_BUFFER_SIZE 1048576   /* size of input blocks read at once */
+#endif
+
+/* size of the size field of binary records (option -F bin) */
+#define INPUT_BINARY_SIZE_LEN 8
+
+/* A reader splitting an input stream into lines (option -i)
+   - lines are returned in place, within its buffer, which grows when a line
+     does not fit */
+struct input_reader {
+    int fd;                         /* input file descriptor */
+    char delim;                     /* line delimiter ('\n' or '\0') */
+    char *data;                     /* buffer */
+    size_t size;                    /* allocated size */
+    size_t start;                   /* start of next line */
+    size_t end;                     /* end of data read */
+    unsigned char eof;              /* end of input reached */
+};
+
+int init_input_reader(struct input_reader *reader, int fd, char delim);
+void uninit_input_reader(struct input_reader *reader);
+int read_input_line(struct input_reader *reader, char **line, size_t *len);
+int read_input_record(struct input_reader *reader, size_t len,
+    char **record);
+int parse_arbitrary_value(char *line, fsize_t *size, char **path);
+int parse_separated_value(char *line, char sep, unsigned char quoted,
+    unsigned int size_field, unsigned int path_field, fsize_t *size,
+    char **path);
+int parse_binary_value(char *record, size_t record_size, fsize_t *size,
+    char **path);
+int parse_input_value(char *record, const struct program_options *options,
+    fsize_t *size, char **path);
+int set_input_format(const char *format, struct program_options *options);
+struct crawl_task;
+int handle_input_argument(char *argument, struct crawl_task *task,
+    struct file_entry_store *store, fnum_t *count,
+    struct program_options *options);
+int handle_input_file(const char *filename, struct crawl_task *task,
+    struct file_entry_store *store, fnum_t *count,
+    struct program_options *options);
+
+#endif /* _INPUT_H */
@@ -47,6 +47,15 @@ init_options(struct program_options *options)
     assert(DFLT_OPT_MAX_SIZE >= 0);
     assert((DFLT_OPT_ARBITRARYVALUES == OPT_NOARBITRARYVALUES) ||
            (DFLT_OPT_ARBITRARYVALUES == OPT_ARBITRARYVALUES));
+    assert((DFLT_OPT_IN0 == OPT_NOIN0) ||
+           (DFLT_OPT_IN0 == OPT_IN0));
+    assert((DFLT_OPT_INFORMAT == OPT_INFORMAT_TEXT) ||
+           (DFLT_OPT_INFORMAT == OPT_INFORMAT_TSV) ||
+           (DFLT_OPT_INFORMAT == OPT_INFORMAT_CSV) ||
+           (DFLT_OPT_INFORMAT == OPT_INFORMAT_BIN));
+    assert(DFLT_OPT_INSIZEFIELD > 0);
+    assert(DFLT_OPT_INPATHFIELD > 0);
+    assert(DFLT_OPT_INSIZEFIELD != DFLT_OPT_INPATHFIELD);
     assert((DFLT_OPT_OUT0 == OPT_NOOUT0) ||
            (DFLT_OPT_OUT0 == OPT_OUT0));
     assert((DFLT_OPT_ADDSLASH == OPT_NOADDSLASH) ||
@@ -72,13 +81,24 @@ init_options(struct program_options *options)
     assert(DFLT_OPT_PRELOAD_SIZE >= 0);
     assert(DFLT_OPT_OVERLOAD_SIZE >= 0);
     assert(DFLT_OPT_ROUND_SIZE >= 1);
+    assert(DFLT_OPT_NUM_JOBS >= 1);
+    assert((DFLT_OPT_KEEPORDER == OPT_NOKEEPORDER) ||
+           (DFLT_OPT_KEEPORDER == OPT_KEEPORDER));
+    assert(DFLT_OPT_CHECKPOINT >= 0);
+    assert(DFLT_OPT_MEM_LIMIT >= 0);
 
     /* set default options */
     options->num_parts = DFLT_OPT_NUM_PARTS;
     options->max_entries = DFLT_OPT_MAX_ENTRIES;
     options->max_size = DFLT_OPT_MAX_SIZE;
-    options->in_filename = NULL;
+    options->in_filenames = NULL;
+    options->nin_filenames = 0;
     options->arbitrary_values = DFLT_OPT_ARBITRARYVALUES;
+    options->in_zero = DFLT_OPT_IN0;
+    options->in_format = DFLT_OPT_INFORMAT;
+    options->in_size_field = DFLT_OPT_INSIZEFIELD;
+    options->in_path_field = DFLT_OPT_INPATHFIELD;
+    options->in_record_size = DFLT_OPT_INRECORDSIZE;
     options->out_filename = NULL;
     options->out_zero = DFLT_OPT_OUT0;
     options->add_slash = DFLT_OPT_ADDSLASH;
@@ -100,18 +120,46 @@ init_options(struct program_options *options)
     options->live_mode = DFLT_OPT_LIVEMODE;
     options->pre_part_hook = NULL;
     options->post_part_hook = NULL;
+    options->hook_coproc = NULL;
+    options->job_cmd = NULL;
+    options->stream_cmd = NULL;
+    options->hook_jobs = DFLT_OPT_HOOK_JOBS;
     options->preload_size = DFLT_OPT_PRELOAD_SIZE;
     options->overload_size = DFLT_OPT_OVERLOAD_SIZE;
     options->round_size = DFLT_OPT_ROUND_SIZE;
+    options->num_jobs = DFLT_OPT_NUM_JOBS;
+    options->keep_order = DFLT_OPT_KEEPORDER;
+    options->checkpoint = DFLT_OPT_CHECKPOINT;
+    options->mem_limit = DFLT_OPT_MEM_LIMIT;
+    options->cache_filename = NULL;
+    options->snapshot_out = NULL;
+    options->snapshot_in = NULL;
 }
 
 /* Un-initialize global options structure */
 void
 uninit_options(struct program_options *options)
 {
+    if(options->snapshot_in != NULL)
+        free(options->snapshot_in);
+    if(options->snapshot_out != NULL)
+        free(options->snapshot_out);
+    if(options->cache_filename != NULL)
+        free(options->cache_filename);
+    options->mem_limit = DFLT_OPT_MEM_LIMIT;
+    options->checkpoint = DFLT_OPT_CHECKPOINT;
+    options->keep_order = DFLT_OPT_KEEPORDER;
+    options->num_jobs = DFLT_OPT_NUM_JOBS;
     options->round_size = DFLT_OPT_ROUND_SIZE;
     options->overload_size = DFLT_OPT_OVERLOAD_SIZE;
     options->preload_size = DFLT_OPT_PRELOAD_SIZE;
+    options->hook_jobs = DFLT_OPT_HOOK_JOBS;
+    if(options->stream_cmd != NULL)
+        free(options->stream_cmd);
+    if(options->job_cmd != NULL)
+        free(options->job_cmd);
+    if(options->hook_coproc != NULL)
+        free(options->hook_coproc);
     if(options->post_part_hook != NULL)
         free(options->post_part_hook);
     if(options->pre_part_hook != NULL)
@@ -140,9 +188,14 @@ uninit_options(struct program_options *options)
     options->out_zero = DFLT_OPT_OUT0;
     if(options->out_filename != NULL)
         free(options->out_filename);
+    options->in_record_size = DFLT_OPT_INRECORDSIZE;
+    options->in_path_field = DFLT_OPT_INPATHFIELD;
+    options->in_size_field = DFLT_OPT_INSIZEFIELD;
+    options->in_format = DFLT_OPT_INFORMAT;
+    options->in_zero = DFLT_OPT_IN0;
     options->arbitrary_values = DFLT_OPT_ARBITRARYVALUES;
-    if(options->in_filename != NULL)
-        free(options->in_filename);
+    if(options->in_filenames != NULL)
+        str_cleanup(&(options->in_filenames), &(options->nin_filenames));
     options->max_size = DFLT_OPT_MAX_SIZE;
     options->max_entries = DFLT_OPT_MAX_ENTRIES;
     options->num_parts = DFLT_OPT_NUM_PARTS;
@@ -46,13 +46,35 @@ struct program_options {
 /* maximum partition size (option -s) */
 #define DFLT_OPT_MAX_SIZE           0
     fsize_t max_size;
-/* input file (option -i); NULL = undefined, "-" = stdin, "filename" */
-    char *in_filename;
+/* input files (option -i, may be specified more than once);
+   NULL = undefined, "-" = stdin, "filename" */
+    char **in_filenames;
+    unsigned int nin_filenames;
 /* arbitrary values (option -a) */
 #define OPT_NOARBITRARYVALUES       0
 #define OPT_ARBITRARYVALUES         1
 #define DFLT_OPT_ARBITRARYVALUES    OPT_NOARBITRARYVALUES
     unsigned char arbitrary_values;
+/* input filenames end with a null character (option -Z) */
+#define OPT_NOIN0                   0
+#define OPT_IN0                     1
+#define DFLT_OPT_IN0                OPT_NOIN0
+    unsigned char in_zero;
+/* input format of arbitrary values (option -F) */
+#define OPT_INFORMAT_TEXT           0   /* "size(blank)path" */
+#define OPT_INFORMAT_TSV            1   /* tab-separated fields */
+#define OPT_INFORMAT_CSV            2   /* comma-separated fields */
+#define OPT_INFORMAT_BIN            3   /* fixed-size binary records */
+#define DFLT_OPT_INFORMAT           OPT_INFORMAT_TEXT
+    unsigned char in_format;
+/* fields holding size and path, starting from 1 (option -F tsv and csv) */
+#define DFLT_OPT_INSIZEFIELD        1
+#define DFLT_OPT_INPATHFIELD        2
+    unsigned int in_size_field;
+    unsigned int in_path_field;
+/* size of binary records (option -F bin) */
+#define DFLT_OPT_INRECORDSIZE       0
+    size_t in_record_size;
 /* output file (option -o); NULL = stdout, "filename" */
     char *out_filename;
 /* add a null character after filename in file lists */
@@ -123,6 +145,16 @@ struct program_options {
     char *pre_part_hook;
 /* post-partition hook (option -W) */
     char *post_part_hook;
+/* hook co-process, fed with partition events (option -P) */
+    char *hook_coproc;
+/* job executed for each finished partition (option -C) */
+    char *job_cmd;
+/* consumer each partition is streamed to (option -S) */
+    char *stream_cmd;
+/* maximum number of hooks and jobs running asynchronously (option -H);
+   0 = synchronous hooks */
+#define DFLT_OPT_HOOK_JOBS          0
+    unsigned int hook_jobs;
 /* preload partitions (option -p) */
 #define DFLT_OPT_PRELOAD_SIZE       0
     fsize_t preload_size;
@@ -132,6 +164,26 @@ struct program_options {
 /* round file size up (option -r) */
 #define DFLT_OPT_ROUND_SIZE         1
     fsize_t round_size;
+/* number of crawling and sorting threads (option -j) */
+#define DFLT_OPT_NUM_JOBS           1
+    unsigned int num_jobs;
+/* keep crawling order when using threads (option -J) */
+#define OPT_NOKEEPORDER             0
+#define OPT_KEEPORDER               1
+#define DFLT_OPT_KEEPORDER          OPT_NOKEEPORDER
+    unsigned char keep_order;
+/* checkpoint every n file entries (option -k) */
+#define DFLT_OPT_CHECKPOINT         0
+    fnum_t checkpoint;
+/* memory limit when sorting entries (option -M) */
+#define DFLT_OPT_MEM_LIMIT          0
+    fsize_t mem_limit;
+/* crawl cache file (option -c); NULL = no cache, "filename" */
+    char *cache_filename;
+/* snapshot file to save file entries to (option -O); NULL = none */
+    char *snapshot_out;
+/* snapshot file to load file entries from (option -I); NULL = none */
+    char *snapshot_in;
 };
 
 void init_options(struct program_options *options);
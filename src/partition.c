@@ -102,46 +102,98 @@ uninit_partitions(struct partition *head)
     return;
 }
 
-/* Crawl partitions and return the least-loaded partition index */
-pnum_t
-find_smallest_partition_index(struct partition *head)
+/**************************************************
+ Array of partition pointers manipulation functions
+ **************************************************/
+
+/* Initialize an array of partition pointers from a double-linked
+   list of partitions (head) */
+void
+init_partition_p(struct partition **partition_p, pnum_t num_parts,
+    struct partition *head)
 {
-    assert(head != NULL);
+    assert(partition_p != NULL);
 
     /* be sure to start at first partition */
     rewind_list(head);
 
-    /* start values */
-    fsize_t smallest_partition_value = head->size;
-    pnum_t smallest_partition_index = 0;
-
     pnum_t i = 0;
-    while(head != NULL) {
-        if(head->size < smallest_partition_value) {
-            smallest_partition_value = head->size;
-            smallest_partition_index = i;
-        }
+    while((head != NULL) && (i < num_parts)) {
+        partition_p[i] = head;
         head = head->nextp;
         i++;
     }
-    return (smallest_partition_index);
+    return;
 }
 
-/* Return a pointer to a given partition */
-struct partition *
-get_partition_at(struct partition *head, pnum_t index)
+/* Return 1 if partition at index a is less loaded than partition at index b,
+   else 0 (lowest index wins on equal sizes) */
+static int
+partition_heap_less(struct partition **partition_p, pnum_t a, pnum_t b)
 {
-    assert(head != NULL);
+    return ((partition_p[a]->size < partition_p[b]->size) ||
+        ((partition_p[a]->size == partition_p[b]->size) && (a < b)));
+}
 
-    /* be sure to start at first partition */
-    rewind_list(head);
+/* Move heap element at position i down to its place */
+static void
+partition_heap_sift_down(pnum_t *heap, pnum_t num_parts,
+    struct partition **partition_p, pnum_t i)
+{
+    while(1) {
+        pnum_t smallest = i;
+        pnum_t left = (2 * i) + 1;
+        pnum_t right = left + 1;
+
+        if((left < num_parts) &&
+            partition_heap_less(partition_p, heap[left], heap[smallest]))
+            smallest = left;
+        if((right < num_parts) &&
+            partition_heap_less(partition_p, heap[right], heap[smallest]))
+            smallest = right;
+        if(smallest == i)
+            return;
+
+        pnum_t tmp = heap[i];
+        heap[i] = heap[smallest];
+        heap[smallest] = tmp;
+        i = smallest;
+    }
+}
 
-    pnum_t i = 0;
-    while((head != NULL) && (i < index)) {
-        head = head->nextp;
-        i++;
+/* Initialize a binary min-heap of partition indexes, keyed by partition size
+   - heap[0] is then the least-loaded partition index */
+void
+init_partition_heap(pnum_t *heap, pnum_t num_parts,
+    struct partition **partition_p)
+{
+    assert(heap != NULL);
+    assert(num_parts > 0);
+    assert(partition_p != NULL);
+
+    pnum_t i;
+    for(i = 0; i < num_parts; i++)
+        heap[i] = i;
+
+    i = num_parts / 2;
+    while(i > 0) {
+        i--;
+        partition_heap_sift_down(heap, num_parts, partition_p, i);
     }
-    return (head);
+    return;
+}
+
+/* Restore heap order after the size of partition heap[0] has changed */
+void
+update_partition_heap(pnum_t *heap, pnum_t num_parts,
+    struct partition **partition_p)
+{
+    assert(heap != NULL);
+    assert(num_parts > 0);
+    assert(partition_p != NULL);
+
+    partition_heap_sift_down(heap, num_parts, partition_p, 0);
+    return;
 }
 
 /* Print partitions from head */
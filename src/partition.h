@@ -45,8 +45,12 @@ struct partition {
 int add_partitions(struct partition **head, pnum_t num_parts,
     struct program_options *options);
 void uninit_partitions(struct partition *head);
-pnum_t find_smallest_partition_index(struct partition *head);
-struct partition * get_partition_at(struct partition *head, pnum_t index);
+void init_partition_p(struct partition **partition_p, pnum_t num_parts,
+    struct partition *head);
+void init_partition_heap(pnum_t *heap, pnum_t num_parts,
+    struct partition **partition_p);
+void update_partition_heap(pnum_t *heap, pnum_t num_parts,
+    struct partition **partition_p);
 void print_partitions(struct partition *head);
 
 #endif /* _PARTITION_H */
@@ -0,0 +1,282 @@
+/*-
+ * Copyright (c) 2011-2019 Ganael LAPLANCHE <ganael.laplanche@martymac.org>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHORS AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHORS OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include "types.h"
+#include "utils.h"
+#include "options.h"
+#include "file_entry.h"
+#include "snapshot.h"
+
+/* fprintf(3), fopen(3), fwrite(3) */
+#include <stdio.h>
+
+/* malloc(3) */
+#include <stdlib.h>
+
+/* strerror(3), strlen(3), memchr(3) */
+#include <string.h>
+
+/* errno */
+#include <errno.h>
+
+/* assert(3) */
+#include <assert.h>
+
+/* uint32_t, uint64_t */
+#include <stdint.h>
+
+/* open(2) */
+#include <fcntl.h>
+
+/* fstat(2) */
+#include <sys/types.h>
+#include <sys/stat.h>
+
+/* close(2) */
+#include <unistd.h>
+
+/* mmap(2) */
+#include <sys/mman.h>
+
+/* Snapshot file format (options -O and -I), native byte order
+   - a header
+   - store's arrays, as is : sizes (num_entries), dirs (num_entries) and
+     dir_parents (num_dirs)
+   - names, then directory names, each one ending with a '\0'
+   Arrays are mapped as is when loading a snapshot, only pointers to names
+   have to be computed. */
+#define SNAPSHOT_MAGIC          "FPSNAP01"
+#define SNAPSHOT_MAGIC_LEN      8
+#define SNAPSHOT_BYTE_ORDER     0x01020304
+
+struct snapshot_header {
+    char magic[SNAPSHOT_MAGIC_LEN];
+    uint32_t byte_order;            /* SNAPSHOT_BYTE_ORDER */
+    uint32_t types_size;            /* sizes of fsize_t and fnum_t */
+    uint64_t num_entries;           /* number of entries */
+    uint64_t num_dirs;              /* number of directory nodes */
+    uint64_t names_size;            /* size of names */
+    uint64_t dir_names_size;        /* size of directory names */
+};
+
+#define SNAPSHOT_TYPES_SIZE     ((sizeof(fsize_t) << 8) | sizeof(fnum_t))
+
+/* Write strings (each one with its trailing '\0') to stream
+   - returns 0 (success) or 1 (failure) */
+static int
+snapshot_write_strings(char **strings, fnum_t num, FILE *fp)
+{
+    fnum_t i;
+    for(i = 0; i < num; i++) {
+        if(fwrite(strings[i], strlen(strings[i]) + 1, 1, fp) != 1)
+            return (1);
+    }
+    return (0);
+}
+
+/* Set pointers to num strings (each one ending with a '\0') from data
+   - returns 0 (success) or 1 (data does not hold exactly num strings) */
+static int
+snapshot_map_strings(char **strings, fnum_t num, char *data, size_t size)
+{
+    fnum_t i;
+    for(i = 0; i < num; i++) {
+        char *end = memchr(data, '\0', size);
+        if(end == NULL)
+            return (1);
+        strings[i] = data;
+        size -= (end - data) + 1;
+        data = end + 1;
+    }
+    return ((size == 0) ? 0 : 1);
+}
+
+/* Save store's file entries to snapshot file filename
+   - returns 0 (success) or 1 (failure) */
+int
+save_file_entry_snapshot(struct file_entry_store *store,
+    const char *filename)
+{
+    assert(store != NULL);
+    assert(filename != NULL);
+
+    struct snapshot_header header;
+    fnum_t i;
+
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, SNAPSHOT_MAGIC, SNAPSHOT_MAGIC_LEN);
+    header.byte_order = SNAPSHOT_BYTE_ORDER;
+    header.types_size = SNAPSHOT_TYPES_SIZE;
+    header.num_entries = store->num_entries;
+    header.num_dirs = store->num_dirs;
+    for(i = 0; i < store->num_entries; i++)
+        header.names_size += strlen(store->names[i]) + 1;
+    for(i = 0; i < store->num_dirs; i++)
+        header.dir_names_size += strlen(store->dir_names[i]) + 1;
+
+    FILE *fp = fopen(filename, "w");
+    if(fp == NULL) {
+        fprintf(stderr, "%s: %s\n", filename, strerror(errno));
+        return (1);
+    }
+
+    if((fwrite(&header, sizeof(header), 1, fp) != 1) ||
+        (fwrite(store->sizes, sizeof(fsize_t), store->num_entries, fp) !=
+        store->num_entries) ||
+        (fwrite(store->dirs, sizeof(fnum_t), store->num_entries, fp) !=
+        store->num_entries) ||
+        (fwrite(store->dir_parents, sizeof(fnum_t), store->num_dirs, fp) !=
+        store->num_dirs) ||
+        (snapshot_write_strings(store->names, store->num_entries, fp) != 0) ||
+        (snapshot_write_strings(store->dir_names, store->num_dirs, fp) != 0)) {
+        fprintf(stderr, "%s: %s\n", filename, strerror(errno));
+        fclose(fp);
+        return (1);
+    }
+
+    if(fclose(fp) != 0) {
+        fprintf(stderr, "%s: %s\n", filename, strerror(errno));
+        return (1);
+    }
+    return (0);
+}
+
+/* Load file entries from snapshot file filename into (empty) store
+   - store's arrays are mapped from the snapshot, store cannot be added
+     entries afterwards
+   - returns 0 (success) or 1 (failure) */
+int
+load_file_entry_snapshot(struct file_entry_store *store,
+    const char *filename)
+{
+    assert(store != NULL);
+    assert(store->num_entries == 0);
+    assert(store->num_dirs == 0);
+    assert(filename != NULL);
+
+    struct snapshot_header header;
+    struct stat st;
+    char *data;
+    fnum_t i;
+
+    int fd = open(filename, O_RDONLY);
+    if(fd < 0) {
+        fprintf(stderr, "%s: %s\n", filename, strerror(errno));
+        return (1);
+    }
+    if(fstat(fd, &st) < 0) {
+        fprintf(stderr, "%s: %s\n", filename, strerror(errno));
+        close(fd);
+        return (1);
+    }
+
+    /* check header and file size */
+    if((st.st_size < (off_t)sizeof(header)) ||
+        (read(fd, &header, sizeof(header)) != sizeof(header)) ||
+        (memcmp(header.magic, SNAPSHOT_MAGIC, SNAPSHOT_MAGIC_LEN) != 0) ||
+        (header.byte_order != SNAPSHOT_BYTE_ORDER) ||
+        (header.types_size != SNAPSHOT_TYPES_SIZE) ||
+        (header.num_entries > ((uint64_t)st.st_size /
+        (sizeof(fsize_t) + sizeof(fnum_t) + 1))) ||
+        (header.num_dirs > ((uint64_t)st.st_size / (sizeof(fnum_t) + 1))) ||
+        (header.names_size > (uint64_t)st.st_size) ||
+        (header.dir_names_size > (uint64_t)st.st_size) ||
+        ((uint64_t)st.st_size != sizeof(header) +
+        (header.num_entries * (sizeof(fsize_t) + sizeof(fnum_t))) +
+        (header.num_dirs * sizeof(fnum_t)) +
+        header.names_size + header.dir_names_size)) {
+        fprintf(stderr, "%s: invalid or incompatible snapshot\n", filename);
+        close(fd);
+        return (1);
+    }
+
+    /* map file privately (changes made to store's arrays in memory must not
+       reach the snapshot) */
+    data = mmap(NULL, (size_t)st.st_size, PROT_READ | PROT_WRITE,
+        MAP_PRIVATE, fd, 0);
+    close(fd);
+    if(data == MAP_FAILED) {
+        fprintf(stderr, "%s: %s\n", filename, strerror(errno));
+        return (1);
+    }
+    store->map = data;
+    store->map_size = (size_t)st.st_size;
+
+    data += sizeof(header);
+    store->sizes = (fsize_t *)data;
+    data += header.num_entries * sizeof(fsize_t);
+    store->dirs = (fnum_t *)data;
+    data += header.num_entries * sizeof(fnum_t);
+    store->dir_parents = (fnum_t *)data;
+    data += header.num_dirs * sizeof(fnum_t);
+
+    /* compute pointers to names */
+    if(header.num_entries > 0) {
+        if_not_malloc(store->names, sizeof(char *) * header.num_entries,
+            goto error;
+        )
+        if_not_malloc(store->partition_indexes,
+            sizeof(pnum_t) * header.num_entries,
+            goto error;
+        )
+    }
+    if(header.num_dirs > 0) {
+        if_not_malloc(store->dir_names, sizeof(char *) * header.num_dirs,
+            goto error;
+        )
+    }
+    if((snapshot_map_strings(store->names, header.num_entries, data,
+        header.names_size) != 0) ||
+        (snapshot_map_strings(store->dir_names, header.num_dirs,
+        data + header.names_size, header.dir_names_size) != 0))
+        goto invalid;
+
+    /* check directory nodes (a parent node is always created before its
+       children) */
+    for(i = 0; i < header.num_entries; i++) {
+        if((store->dirs[i] != FILE_ENTRY_NO_DIR) &&
+            (store->dirs[i] >= header.num_dirs))
+            goto invalid;
+        store->partition_indexes[i] = 0; /* set during dispatch */
+    }
+    for(i = 0; i < header.num_dirs; i++) {
+        if((store->dir_parents[i] != FILE_ENTRY_NO_DIR) &&
+            (store->dir_parents[i] >= i))
+            goto invalid;
+    }
+
+    store->num_entries = header.num_entries;
+    store->alloc_entries = header.num_entries;
+    store->num_dirs = header.num_dirs;
+    store->alloc_dirs = header.num_dirs;
+    return (0);
+
+invalid:
+    fprintf(stderr, "%s: invalid or incompatible snapshot\n", filename);
+error:
+    uninit_file_entry_store(store);
+    return (1);
+}
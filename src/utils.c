@@ -82,68 +82,16 @@ get_num_digits(double i)
     return (logvalue >= 0 ? (unsigned int)logvalue + 1 : 0);
 }
 
-/* Return the size of a file or directory
-   - a pointer to an existing stat must be provided */
+/* Return the size of a file
+   - only regular files have a size, 0 is returned for other file types
+     (directories' sizes are computed while crawling, see
+     walk_file_entries()) */
 fsize_t
-get_size(char *file_path, struct stat *file_stat,
-    struct program_options *options)
+get_size(const struct stat *file_stat)
 {
-    assert(file_path != NULL);
     assert(file_stat != NULL);
-    assert(options != NULL);
-
-    fsize_t file_size = 0;  /* current return value */
-
-    /* if file_path is not a directory,
-       return st_size for regular files (only) */
-    if(!S_ISDIR(file_stat->st_mode)) {
-        return (S_ISREG(file_stat->st_mode) ? file_stat->st_size : 0);
-    }
-
-    /* directory, use fts */
-    FTS *ftsp = NULL;
-    FTSENT *p = NULL;
-    int fts_options = (options->follow_symbolic_links == OPT_FOLLOWSYMLINKS) ?
-        FTS_LOGICAL : FTS_PHYSICAL;
-    fts_options |= (options->cross_fs_boundaries == OPT_NOCROSSFSBOUNDARIES) ?
-        FTS_XDEV : 0;
-
-    char *fts_argv[] = { file_path, NULL };
-    if((ftsp = fts_open(fts_argv, fts_options, NULL)) == NULL) {
-        fprintf(stderr, "%s: fts_open()\n", file_path);
-        return (0);
-    }
-
-    while((p = fts_read(ftsp)) != NULL) {
-        switch (p->fts_info) {
-            case FTS_DNR:   /* un-readable directory */
-            case FTS_ERR:   /* misc error */
-            case FTS_NS:    /* stat() error */
-                fprintf(stderr, "%s: %s\n", p->fts_path,
-                    strerror(p->fts_errno));
-                continue;
-
-            case FTS_DC:
-                fprintf(stderr, "%s: filesystem loop detected\n", p->fts_path);
-                continue;
-
-            case FTS_F:
-                file_size += p->fts_statp->st_size;
-                continue;
-
-            /* skip everything else (only count regular files' size) */
-            default:
-                continue;
-        }
-    }
-
-    if(errno != 0)
-        fprintf(stderr, "%s: fts_read()\n", file_path);
-
-    if(fts_close(ftsp) < 0)
-        fprintf(stderr, "%s: fts_close()\n", file_path);
 
-    return (file_size);
+    return (S_ISREG(file_stat->st_mode) ? file_stat->st_size : 0);
 }
 
 /* Return absolute path for given path
@@ -363,45 +311,3 @@ clone_env(void)
     }
     return (new_env);
 }
-
-/* Push a str pointer to a cloned environ(7)
-   - return enlarged environ through env
-   - returned environ must be freed later
-   - return 0 (success) or 1 (failure) */
-int
-push_env(char *str, char ***env)
-{
-    assert(str != NULL);
-    assert(env != NULL);
-    assert(*env != NULL);
-
-    unsigned int env_size = 0;
-    char **new_env = NULL;
-
-    /* compute environ size */
-    while((*env)[env_size]) env_size++;
-    /* add our pointer */
-    env_size++;
-    /* add ending NULL */
-    env_size++;
-
-    size_t malloc_size = sizeof(char *) * env_size;
-    if_not_malloc(new_env, malloc_size,
-        return (1);
-    )
-
-    /* copy each pointer, beginning from the ending NULL value */
-    new_env[env_size - 1] = NULL;
-    new_env[env_size - 2] = str;
-    env_size -= 2;
-    while(env_size > 0) {
-        new_env[env_size - 1] = (*env)[env_size - 1];
-        env_size--;
-    }
-
-    /* free previous environment and update env */
-    free(*env);
-    *env = new_env;
-
-    return (0);
-}
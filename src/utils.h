@@ -80,8 +80,7 @@
     }
 
 unsigned int get_num_digits(double i);
-fsize_t get_size(char *file_path, struct stat *file_stat,
-    struct program_options *options);
+fsize_t get_size(const struct stat *file_stat);
 char *abs_path(const char *path);
 int str_push(char ***array, unsigned int *num, const char * const str);
 void str_cleanup(char ***array, unsigned int *num);
@@ -90,6 +89,5 @@ int file_match(const char * const * const array, const unsigned int num,
 int valid_file(const FTSENT * const p, struct program_options *options,
     unsigned char is_leaf);
 char ** clone_env(void);
-int push_env(char *str, char ***env);
 
 #endif /* _UTILS_H */